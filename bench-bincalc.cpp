@@ -0,0 +1,455 @@
+/*! Benchmarks for the bincalc engine, on generated expressions.
+
+    Times each stage separately over the same expressions, lexing,
+    compiling, evaluating and formatting, then the row mode kernels
+    against the interpreter, and finally bincalc itself end to end on a
+    file of the expressions. Run by "make bench".
+*/
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <spawn.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <getopt.h>
+
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "engine.h"
+
+using namespace bincalc::engine;
+
+extern char ** environ;
+
+static const struct
+{
+    const char * identifier;
+    operator_t op;
+} binary_operators[] =
+{ { "*", MULTIPLY }, { "/", DIVIDE }, { "%", MODULUS }, { "+", ADD }, { "-", SUBTRACT },
+  { "<<", LEFT_SHIFT }, { ">>", RIGHT_SHIFT }, { "&", AND }, { "^", XOR }, { "|", OR } };
+
+struct generator
+/*! What expressions look like, and the source of randomness */
+{
+    encoding_t mode;
+    int length;     /* Binary operators per expression */
+    int depth;      /* Deepest parenthesis nesting */
+    double unary;   /* Chance of an operand having a unary operator */
+    double nesting; /* Chance of an operand being a parenthesized subexpression */
+    bool variables; /* Whether operands may be x instead of a literal */
+    std::vector<int> mix; /* Indices into binary_operators, repeated to weight them */
+    std::mt19937_64 random;
+};
+
+static bool parse_mix(char * names, generator & gen)
+/*! Space or comma separated operators, each as often as it should appear */
+{
+    gen.mix.clear();
+    for (char * name = strtok(names, " ,"); name; name = strtok(NULL, " ,"))
+    {
+        int index = 0;
+        while (index < (int)(sizeof binary_operators / sizeof binary_operators[0]) &&
+               strcmp(name, binary_operators[index].identifier) != 0)
+        {
+            index++;
+        }
+        if (index == (int)(sizeof binary_operators / sizeof binary_operators[0]))
+        {
+            return false;
+        }
+        if (is_supported(binary_operators[index].op, gen.mode))
+        {
+            gen.mix.push_back(index);
+        }
+    }
+    return !gen.mix.empty();
+}
+
+static bool chance(generator & gen, double probability)
+{
+    return std::uniform_real_distribution<double>(0, 1)(gen.random) < probability;
+}
+
+static void generate_literal(generator & gen, std::string & out, uint64_t limit)
+/*! A literal from 1 to limit, or any value when limit is 0 */
+{
+    int size = encoding_sizes[gen.mode];
+    if (gen.mode >= F32)
+    {
+        append(out, "%.3f", std::uniform_real_distribution<double>(0, 1000)(gen.random));
+        return;
+    }
+    uint64_t value = gen.random();
+    if (limit)
+    {
+        append(out, "%" PRIu64, 1 + value % limit);
+    }
+    else if (size > 8)
+    {
+        /* Past 64 bits, only as hex */
+        append(out, "x%016" PRIx64 "%016" PRIx64, (uint64_t)gen.random(), value);
+    }
+    else if (chance(gen, 0.5))
+    {
+        append(out, "x%0*" PRIx64, 2 * size, size == 8 ? value : value & ((UINT64_C(1) << 8 * size) - 1));
+    }
+    else
+    {
+        /* Non-negative in every mode; x literals cover the rest */
+        int bits = 8 * size - (gen.mode <= S128);
+        append(out, "%" PRIu64, bits == 64 ? value : value & ((UINT64_C(1) << bits) - 1));
+    }
+}
+
+static void generate(generator & gen, std::string & out, int depth, int count)
+/*! An expression with count binary operators, nested at most
+    gen.depth - depth parentheses deeper. Divisors and shift amounts are
+    always literals in range, so evaluation never traps or fails */
+{
+    int remaining = count;
+    operator_t op = INVALID_OP;
+    for (bool first = true; first || remaining > 0; first = false)
+    {
+        if (!first)
+        {
+            int index = gen.mix[gen.random() % gen.mix.size()];
+            op = binary_operators[index].op;
+            out += ' ';
+            out += binary_operators[index].identifier;
+            out += ' ';
+            remaining--;
+        }
+        if (gen.mode < F32 && (op == DIVIDE || op == MODULUS))
+        {
+            generate_literal(gen, out, 100);
+            continue;
+        }
+        if (op == LEFT_SHIFT || op == RIGHT_SHIFT)
+        {
+            append(out, "%d", (int)(gen.random() % (8 * encoding_sizes[gen.mode])));
+            continue;
+        }
+        if (chance(gen, gen.unary))
+        {
+            /* Not "-5", which is a literal and out of range in unsigned modes */
+            out += gen.mode < F32 && chance(gen, 0.5) ? "~" : "- ";
+        }
+        if (depth < gen.depth && remaining > 0 && chance(gen, gen.nesting))
+        {
+            int inner = 1 + gen.random() % remaining;
+            remaining -= inner;
+            out += '(';
+            generate(gen, out, depth + 1, inner);
+            out += ')';
+        }
+        else if (gen.variables && chance(gen, 0.5))
+        {
+            out += 'x';
+        }
+        else
+        {
+            generate_literal(gen, out, 0);
+        }
+    }
+}
+
+template <typename function>
+static double time_stage(double seconds, size_t count, function stage)
+/*! Run stage, which handles count items, until seconds have passed;
+    returns nanoseconds per item */
+{
+    typedef std::chrono::steady_clock clock;
+    clock::time_point start = clock::now();
+    size_t runs = 0;
+    double elapsed;
+    do
+    {
+        stage();
+        runs++;
+        elapsed = std::chrono::duration<double>(clock::now() - start).count();
+    } while (elapsed < seconds);
+    return elapsed * 1e9 / (runs * count);
+}
+
+static void report(const char * stage, double ns, size_t bytes, size_t count)
+/*! bytes is the input handled per item times count, or 0 without a rate */
+{
+    if (bytes)
+    {
+        printf("%-20s %12.1f %10.1f\n", stage, ns, bytes / (ns * count) * 1e3);
+    }
+    else
+    {
+        printf("%-20s %12.1f %10s\n", stage, ns, "-");
+    }
+}
+
+static volatile uint64_t sink;
+
+static double time_end_to_end(const char * bincalc, const char * path, const char * mode,
+                              size_t count, double seconds)
+/*! bincalc -f path mode, with output to /dev/null */
+{
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+    posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+    char * argv[] = {(char *)bincalc, (char *)"-f", (char *)path, (char *)mode, NULL};
+    bool failed = false;
+    double ns = time_stage(seconds, count, [&]
+    {
+        pid_t pid;
+        int status;
+        if (posix_spawn(&pid, bincalc, &actions, NULL, argv, environ) != 0 ||
+            waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        {
+            failed = true;
+        }
+    });
+    posix_spawn_file_actions_destroy(&actions);
+    return failed ? -1 : ns;
+}
+
+static void usage(char * me)
+{
+    fprintf(stderr, "Usage: %s [-n count] [-l length] [-d depth] [-o operators] [-u chance]\n"
+                    "       [-p chance] [-t seconds] [-r seed] [-b bincalc] mode\n"
+                    "-n: Expressions to generate (10000)\n"
+                    "-l: Binary operators in each expression (8)\n"
+                    "-d: Deepest parenthesis nesting (3)\n"
+                    "-o: Operators to choose from, space or comma separated, repeated\n"
+                    "    to make them more likely (all the mode supports)\n"
+                    "-u: Chance of an operand having a unary operator (0.1)\n"
+                    "-p: Chance of an operand being a parenthesized subexpression (0.25)\n"
+                    "-t: Seconds to spend on each stage (0.5)\n"
+                    "-r: Seed for the generator (1)\n"
+                    "-b: bincalc to time end to end (./bincalc), or - for none\n", me);
+}
+
+int main(int argc, char * argv[])
+{
+    generator gen = {INVALID_ENCODING, 8, 3, 0.1, 0.25, false};
+    size_t count = 10000;
+    double seconds = 0.5;
+    uint64_t seed = 1;
+    const char * bincalc = "./bincalc";
+    char * operators = NULL;
+    int option;
+    while ((option = getopt(argc, argv, "n:l:d:o:u:p:t:r:b:")) != -1)
+    {
+        switch (option)
+        {
+        case 'n':
+            count = strtoull(optarg, NULL, 10);
+            break;
+        case 'l':
+            gen.length = atoi(optarg);
+            break;
+        case 'd':
+            gen.depth = atoi(optarg);
+            break;
+        case 'o':
+            operators = optarg;
+            break;
+        case 'u':
+            gen.unary = atof(optarg);
+            break;
+        case 'p':
+            gen.nesting = atof(optarg);
+            break;
+        case 't':
+            seconds = atof(optarg);
+            break;
+        case 'r':
+            seed = strtoull(optarg, NULL, 10);
+            break;
+        case 'b':
+            bincalc = strcmp(optarg, "-") == 0 ? NULL : optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (argc - optind != 1 || (gen.mode = parse_mode(argv[optind])) == INVALID_ENCODING ||
+        lane_counts[gen.mode] > 1 || count == 0 || gen.length < 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    char all_operators[] = "* / % + - << >> & ^ |";
+    if (!parse_mix(operators ? operators : all_operators, gen))
+    {
+        fprintf(stderr, "No operators for %s\n", encoding_names[gen.mode]);
+        return 1;
+    }
+    gen.random.seed(seed);
+
+    std::string text;
+    std::vector<size_t> starts;
+    for (size_t index = 0; index < count; index++)
+    {
+        starts.push_back(text.size());
+        generate(gen, text, 0, gen.length);
+        text += '\n';
+    }
+    starts.push_back(text.size());
+    size_t bytes = text.size();
+    printf("%zu %s expressions, %d operators, depth %d, %zu bytes\n",
+           count, encoding_names[gen.mode], gen.length, gen.depth, bytes);
+    printf("%-20s %12s %10s\n", "stage", "ns/expr", "MB/s");
+
+    arena pool = {};
+    report("lex", time_stage(seconds, count, [&]
+    {
+        for (size_t index = 0; index < count; index++)
+        {
+            reset_arena(pool);
+            program prog(pool);
+            tokenize(&text[starts[index]], &text[starts[index + 1] - 1], gen.mode, false,
+                     prog.tokens);
+        }
+    }), bytes, count);
+
+    report("lex+compile", time_stage(seconds, count, [&]
+    {
+        for (size_t index = 0; index < count; index++)
+        {
+            reset_arena(pool);
+            program prog(pool);
+            const char * cursor = &text[starts[index]];
+            compile(cursor, &text[starts[index + 1] - 1], gen.mode, prog);
+        }
+    }), bytes, count);
+
+    /* The same expressions with a stray character halfway along, as in
+       fuzzed or mistyped input */
+    std::string bad_text = text;
+    for (size_t index = 0; index < count; index++)
+    {
+        bad_text[(starts[index] + starts[index + 1] - 1) / 2] = '$';
+    }
+    report("lex+compile bad", time_stage(seconds, count, [&]
+    {
+        uint64_t failures = 0;
+        for (size_t index = 0; index < count; index++)
+        {
+            reset_arena(pool);
+            program prog(pool);
+            const char * cursor = &bad_text[starts[index]];
+            const char * end = &bad_text[starts[index + 1] - 1];
+            failures += compile(cursor, end, gen.mode, prog) != NO_ERROR;
+        }
+        sink = failures;
+    }), bytes, count);
+
+    /* The rest work on programs compiled once, all in one arena */
+    arena programs_pool = {};
+    std::vector<program> programs;
+    programs.reserve(count);
+    int slots = 1;
+    for (size_t index = 0; index < count; index++)
+    {
+        programs.emplace_back(programs_pool);
+        const char * cursor = &text[starts[index]];
+        compile(cursor, &text[starts[index + 1] - 1], gen.mode, programs.back());
+        slots = max(slots, stack_slots(programs.back()));
+    }
+    std::vector<stack_slot> stack(slots);
+    std::vector<encoded_value> results(count);
+    report("evaluate", time_stage(seconds, count, [&]
+    {
+        for (size_t index = 0; index < count; index++)
+        {
+            size_t pc;
+            evaluate_program(programs[index], NULL, stack.data(), results[index], pc, NULL);
+        }
+    }), bytes, count);
+
+    report("format", time_stage(seconds, count, [&]
+    {
+        char string[2 * FORMAT_SIZE];
+        uint64_t total = 0;
+        for (size_t index = 0; index < count; index++)
+        {
+            total += format_dec(results[index], string);
+            total += format_hex(results[index], string);
+        }
+        sink = total;
+    }), 0, count);
+
+    /* Row mode: one expression of x, through the interpreter a row at a
+       time and through the block kernels */
+    gen.variables = true;
+    std::string row_text;
+    generate(gen, row_text, 0, gen.length);
+    program row_prog(programs_pool);
+    const char * cursor = row_text.data();
+    compile(cursor, row_text.data() + row_text.size(), gen.mode, row_prog, true);
+    if (row_prog.variables.size() == 1)
+    {
+        optimize(row_prog);
+        row_block rows;
+        init_row_block(rows, row_prog);
+        std::vector<stack_slot> row_stack(max(1, stack_slots(row_prog)));
+        std::vector<encoded_value> column(BLOCK_SIZE);
+        for (int row = 0; row < BLOCK_SIZE; row++)
+        {
+            column[row] = gen.mode == F32 ? encode(F32, (float)row)
+                        : gen.mode == F64 ? encode(F64, (double)row)
+                        : encode(gen.mode, gen.random());
+            memcpy(rows.columns + row * encoding_sizes[gen.mode], &column[row].u64,
+                   encoding_sizes[gen.mode]);
+        }
+        report("rows interpreted", time_stage(seconds, BLOCK_SIZE, [&]
+        {
+            uint64_t total = 0;
+            for (int row = 0; row < BLOCK_SIZE; row++)
+            {
+                size_t pc;
+                encoded_value result;
+                evaluate_program(row_prog, &column[row], row_stack.data(), result, pc, NULL);
+                total += result.u64;
+            }
+            sink = total;
+        }), 0, BLOCK_SIZE);
+        report("rows vectorized", time_stage(seconds, BLOCK_SIZE, [&]
+        {
+            size_t pc;
+            evaluate_rows(row_prog, rows.columns, rows.stack, BLOCK_SIZE, pc, rows.trapped);
+        }), 0, BLOCK_SIZE);
+        free_row_block(rows);
+    }
+
+    if (bincalc)
+    {
+        char path[] = "/tmp/bench-bincalc-XXXXXX";
+        int fd = mkstemp(path);
+        if (fd < 0 || write(fd, text.data(), bytes) != (ssize_t)bytes)
+        {
+            perror(path);
+            return 1;
+        }
+        close(fd);
+        double ns = time_end_to_end(bincalc, path, argv[optind], count, seconds);
+        unlink(path);
+        if (ns < 0)
+        {
+            fprintf(stderr, "%s failed\n", bincalc);
+            return 1;
+        }
+        report("end to end (-f)", ns, bytes, count);
+    }
+
+    programs.clear();
+    free_arena(programs_pool);
+    free_arena(pool);
+    return 0;
+}
@@ -0,0 +1,666 @@
+/*! Header-only, compile-time evaluation of bincalc expressions, so
+    masks and constants can be written as bincalc would compute them:
+
+        constexpr uint16_t mask = bincalc::eval<uint16_t>("x1234 & ~x5678 | ~x1234 & x5678");
+
+    The encoding is the C type: int8_t through int64_t, uint8_t through
+    uint64_t, __int128 and unsigned __int128 (with GNU extensions), float
+    and double. Literals, operators, precedence and wraparound are those
+    of bincalc in that mode, and the operators are the engine's own.
+
+    Errors throw bincalc::eval_error, which in a constant expression
+    makes it fail to compile. Besides bincalc's parse and range errors,
+    that includes results bincalc would take from the machine rather
+    than the language: integer division by zero or of the minimum by -1,
+    shifts by the width of the type (after promotion) or more, and
+    floating-point results that are NaN. Decimal floating-point literals
+    must be exactly a number of up to 19 digits times a power of ten
+    small enough for the type to hold (10^10 for float, 10^22 for
+    double), which rounds correctly with one multiply or divide; hex
+    floats and NaN payloads need bincalc at run time.
+*/
+
+#ifndef BINCALC_EVAL_H
+#define BINCALC_EVAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <limits>
+#include <stdexcept>
+#include <string_view>
+#include <type_traits>
+
+namespace bincalc::engine
+{
+
+enum operator_t
+{
+    OPEN_PAREN,
+    NOT,
+    NEGATE,
+    MULTIPLY,
+    DIVIDE,
+    MODULUS,
+    ADD,
+    SUBTRACT,
+    LEFT_SHIFT,
+    RIGHT_SHIFT,
+    AND,
+    XOR,
+    OR,
+    CLOSE_PAREN,
+    END_EXPRESSION,
+    NUM_OPS,
+    INVALID_OP = -1,
+};
+
+enum arity_t
+{
+    UNARY,
+    BINARY,
+    SENTINEL,
+};
+
+struct operator_info
+{
+    int precedence;
+    arity_t arity;
+    const char * identifier;
+};
+
+inline constexpr operator_info operator_table[] =
+{ { 8, UNARY, "(" },
+  { 7, UNARY, "~" },
+  { 7, UNARY, "-" },
+  { 6, BINARY, "*" },
+  { 6, BINARY, "/" },
+  { 6, BINARY, "%" },
+  { 5, BINARY, "+" },
+  { 5, BINARY, "-" },
+  { 4, BINARY, "<<" },
+  { 4, BINARY, ">>" },
+  { 3, BINARY, "&" },
+  { 2, BINARY, "^" },
+  { 1, BINARY, "|" },
+  { 0, SENTINEL, ")" },
+  { 0, SENTINEL, "\0" } };
+
+template <typename type, bool = std::is_integral_v<type>>
+struct wrapping
+/*! The unsigned type, at least as wide as unsigned int, that type's
+    arithmetic wraps in. Integer promotion would otherwise turn u16 and
+    s32 overflow into signed overflow, which is undefined and so not a
+    constant expression */
+{
+    typedef type natural;
+};
+
+template <typename type>
+struct wrapping<type, true>
+{
+    typedef decltype(std::make_unsigned_t<type>() + 0u) natural;
+};
+
+template <typename type>
+constexpr bool evaluate_operator_integer(operator_t op, type value, type & result)
+{
+    typedef typename wrapping<type>::natural natural;
+    bool success = true;
+    switch (op)
+    {
+    case NOT:
+        result = ~value;
+        break;
+    case NEGATE:
+        result = -(natural)value;
+        break;
+    default:
+        success = false;
+        break;
+    }
+    return success;
+}
+
+template <typename type>
+constexpr bool evaluate_operator_real(operator_t op, type value, type & result)
+{
+    bool success = true;
+    switch (op)
+    {
+    case NEGATE:
+        result = -value;
+        break;
+    default:
+        success = false;
+        break;
+    }
+    return success;
+}
+
+template <typename type>
+constexpr bool division_traps(type left, type right)
+/*! Whether left / right or left % right would trap: by 0, or the most
+    negative value by -1 */
+{
+    if constexpr (std::is_signed_v<type>)
+    {
+        return right == 0 || (right == (type)-1 && left == std::numeric_limits<type>::min());
+    }
+    else
+    {
+        return right == 0;
+    }
+}
+
+template <typename type>
+constexpr bool evaluate_operator_integer(operator_t op, type left, type right, type & result)
+/*! False for an operator integers lack, and for a division that would
+    trap, which is checked first so that it never raises SIGFPE */
+{
+    typedef typename wrapping<type>::natural natural;
+    bool success = true;
+    if ((op == DIVIDE || op == MODULUS) && division_traps(left, right))
+    {
+        return false;
+    }
+    switch (op)
+    {
+    case ADD:
+        result = (natural)left + (natural)right;
+        break;
+    case SUBTRACT:
+        result = (natural)left - (natural)right;
+        break;
+    case MULTIPLY:
+        result = (natural)left * (natural)right;
+        break;
+    case DIVIDE:
+        result = left / right;
+        break;
+    case MODULUS:
+        result = left % right;
+        break;
+    case LEFT_SHIFT:
+        result = (natural)left << right;
+        break;
+    case RIGHT_SHIFT:
+        result = left >> right;
+        break;
+    case AND:
+        result = left & right;
+        break;
+    case OR:
+        result = left | right;
+        break;
+    case XOR:
+        result = left ^ right;
+        break;
+    default:
+        success = false;
+        break;
+    }
+    return success;
+}
+
+template <typename type>
+constexpr bool evaluate_operator_real(operator_t op, type left, type right, type & result)
+{
+    bool success = true;
+    switch (op)
+    {
+    case ADD:
+        result = left + right;
+        break;
+    case SUBTRACT:
+        result = left - right;
+        break;
+    case MULTIPLY:
+        result = left * right;
+        break;
+    case DIVIDE:
+        result = left / right;
+        break;
+    default:
+        success = false;
+        break;
+    }
+    return success;
+}
+
+}
+
+namespace bincalc
+{
+
+class eval_error : public std::invalid_argument
+/*! offset is where in the expression it failed */
+{
+public:
+    eval_error(const char * message, size_t offset)
+        : std::invalid_argument(message), offset(offset) {}
+
+    size_t offset;
+};
+
+namespace eval_detail
+{
+
+using namespace bincalc::engine;
+
+constexpr bool is_digit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+constexpr int hex_digit(char c)
+/*! -1 if c isn't one */
+{
+    return is_digit(c) ? c - '0'
+         : c >= 'a' && c <= 'f' ? c - 'a' + 10
+         : c >= 'A' && c <= 'F' ? c - 'A' + 10
+         : -1;
+}
+
+constexpr char lower(char c)
+{
+    return c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+}
+
+template <typename type>
+struct parser
+/*! Recursive descent over the same grammar bincalc compiles, evaluating
+    as it goes */
+{
+    std::string_view text;
+    size_t cursor;
+
+    [[noreturn]] void fail(const char * message, size_t offset) const
+    {
+        throw eval_error(message, offset);
+    }
+
+    constexpr char peek(size_t ahead = 0) const
+    /*! The end of the text reads as NUL, as in lex_operator */
+    {
+        return cursor + ahead < text.size() ? text[cursor + ahead] : '\0';
+    }
+
+    constexpr void skip_whitespace()
+    {
+        while (cursor < text.size() &&
+               (text[cursor] == ' ' || (text[cursor] >= '\t' && text[cursor] <= '\r')))
+        {
+            cursor++;
+        }
+    }
+
+    constexpr bool match(const char * word)
+    /*! Case-insensitively, as from_chars takes inf and nan */
+    {
+        size_t size = 0;
+        while (word[size] != '\0')
+        {
+            if (lower(peek(size)) != word[size])
+            {
+                return false;
+            }
+            size++;
+        }
+        cursor += size;
+        return true;
+    }
+
+    constexpr operator_t lex_operator(arity_t arity)
+    /*! Consumes the operator; INVALID_OP if nothing matches */
+    {
+        for (int op = 0; op < NUM_OPS; op++)
+        {
+            const char * identifier = operator_table[op].identifier;
+            if ((operator_table[op].arity == UNARY) != (arity == UNARY) ||
+                peek() != identifier[0] || (identifier[0] != '\0' && identifier[1] != '\0' &&
+                                            peek(1) != identifier[1]))
+            {
+                continue;
+            }
+            cursor += identifier[0] == '\0' || identifier[1] == '\0' ? 1 : 2;
+            return (operator_t)op;
+        }
+        return INVALID_OP;
+    }
+
+    constexpr bool parse_hex(type & value)
+    /*! "x" and up to two digits per byte; the bits of value */
+    {
+        if (peek() != 'x' || hex_digit(peek(1)) < 0)
+        {
+            return false;
+        }
+        size_t start = cursor++;
+        typedef std::conditional_t<std::is_floating_point_v<type>,
+                                   std::conditional_t<sizeof(type) == 4, uint32_t, uint64_t>,
+                                   typename wrapping<type>::natural> natural;
+        natural bits = 0;
+        int digits = 0;
+        for (; hex_digit(peek()) >= 0; cursor++)
+        {
+            if ((bits != 0 || peek() != '0') && ++digits > (int)(2 * sizeof(type)))
+            {
+                fail("Value out of range", start);
+            }
+            bits = bits << 4 | hex_digit(peek());
+        }
+        if constexpr (std::is_floating_point_v<type>)
+        {
+            value = __builtin_bit_cast(type, bits);
+        }
+        else
+        {
+            value = (type)bits;
+        }
+        return true;
+    }
+
+    constexpr bool parse_integer(type & value)
+    /*! Decimal, with a "+", or a "-" in signed modes, as parse_int and
+        parse_uint take */
+    {
+        size_t start = cursor;
+        size_t next = cursor;
+        bool negative = false;
+        if ((peek() == '+' || peek() == '-') && is_digit(peek(1)))
+        {
+            negative = peek() == '-';
+            next++;
+        }
+        if (!is_digit(next < text.size() ? text[next] : '\0'))
+        {
+            return false;
+        }
+        if (negative && !std::is_signed_v<type>)
+        {
+            fail("Value out of range", start);
+        }
+        typedef typename wrapping<type>::natural natural;
+        const natural limit = negative ? (natural)std::numeric_limits<type>::max() + 1
+                                       : (natural)std::numeric_limits<type>::max();
+        natural magnitude = 0;
+        bool in_range = true;
+        for (cursor = next; is_digit(peek()); cursor++)
+        {
+            natural digit = peek() - '0';
+            in_range = in_range && magnitude <= (limit - digit) / 10;
+            magnitude = magnitude * 10 + digit;
+        }
+        if (!in_range)
+        {
+            fail("Value out of range", start);
+        }
+        value = negative ? (type)-magnitude : (type)magnitude;
+        return true;
+    }
+
+    constexpr bool parse_real(type & value)
+    /*! What parse_real takes, for the literals noted at the top */
+    {
+        size_t start = cursor;
+        bool negative = peek() == '-';
+        if (peek() == '-' || peek() == '+')
+        {
+            cursor++;
+        }
+        if (peek() == '-' || peek() == '+')
+        {
+            cursor = start;
+            return false;
+        }
+        if ((peek() == '0' && lower(peek(1)) == 'x') || match("nan("))
+        {
+            fail("Literal needs bincalc's run-time parser", start);
+        }
+        if (match("infinity") || match("inf"))
+        {
+            value = negative ? -std::numeric_limits<type>::infinity()
+                             : std::numeric_limits<type>::infinity();
+            return true;
+        }
+        if (match("nan"))
+        {
+            value = negative ? -std::numeric_limits<type>::quiet_NaN()
+                             : std::numeric_limits<type>::quiet_NaN();
+            return true;
+        }
+        uint64_t mantissa = 0;
+        int digits = 0;
+        int exponent = 0;
+        bool any = false;
+        bool point = false;
+        for (; is_digit(peek()) || (peek() == '.' && !point); cursor++)
+        {
+            if (peek() == '.')
+            {
+                point = true;
+                continue;
+            }
+            any = true;
+            if (mantissa == 0 && peek() == '0')
+            {
+                exponent -= point;
+                continue;
+            }
+            if (++digits > 19)
+            {
+                fail("Literal needs bincalc's run-time parser", start);
+            }
+            mantissa = mantissa * 10 + (peek() - '0');
+            exponent -= point;
+        }
+        if (!any)
+        {
+            cursor = start;
+            return false;
+        }
+        if (lower(peek()) == 'e')
+        {
+            size_t mark = cursor++;
+            bool negative_exponent = peek() == '-';
+            if (peek() == '-' || peek() == '+')
+            {
+                cursor++;
+            }
+            if (!is_digit(peek()))
+            {
+                cursor = mark;
+            }
+            int power = 0;
+            for (; is_digit(peek()); cursor++)
+            {
+                power = power < 10000 ? power * 10 + (peek() - '0') : power;
+            }
+            exponent += negative_exponent ? -power : power;
+        }
+        const int exact_power = sizeof(type) == sizeof(float) ? 10 : 22;
+        if (mantissa == 0)
+        {
+            value = 0;
+        }
+        else if (mantissa > (uint64_t)1 << std::numeric_limits<type>::digits ||
+                 exponent > exact_power || exponent < -exact_power)
+        {
+            fail("Literal needs bincalc's run-time parser", start);
+        }
+        else
+        {
+            type scale = 1;
+            for (int index = 0; index < (exponent < 0 ? -exponent : exponent); index++)
+            {
+                scale *= 10;
+            }
+            value = exponent < 0 ? (type)mantissa / scale : (type)mantissa * scale;
+        }
+        if (negative)
+        {
+            value = -value;
+        }
+        return true;
+    }
+
+    constexpr bool parse_literal(type & value)
+    {
+        if (parse_hex(value))
+        {
+            return true;
+        }
+        if constexpr (std::is_floating_point_v<type>)
+        {
+            return parse_real(value);
+        }
+        else
+        {
+            return parse_integer(value);
+        }
+    }
+
+    constexpr type apply(operator_t op, type value, size_t position)
+    {
+        type result = 0;
+        bool success = false;
+        if constexpr (std::is_floating_point_v<type>)
+        {
+            success = evaluate_operator_real<type>(op, value, result);
+        }
+        else
+        {
+            success = evaluate_operator_integer<type>(op, value, result);
+        }
+        if (!success)
+        {
+            fail("Parse error", position);
+        }
+        return result;
+    }
+
+    constexpr type apply(operator_t op, type left, type right, size_t position)
+    {
+        type result = 0;
+        bool success = false;
+        if constexpr (std::is_floating_point_v<type>)
+        {
+            if (op == DIVIDE && right == 0 && left == left)
+            {
+                /* Dividing by zero isn't a constant expression, though
+                   its result is certain unless it is NaN */
+                if (left == 0)
+                {
+                    fail("Result is NaN", position);
+                }
+                bool negative = (left < 0) != (__builtin_bit_cast(
+                    std::conditional_t<sizeof(type) == 4, int32_t, int64_t>, right) < 0);
+                return negative ? -std::numeric_limits<type>::infinity()
+                                : std::numeric_limits<type>::infinity();
+            }
+            success = evaluate_operator_real<type>(op, left, right, result);
+            if (success && result != result && left == left && right == right)
+            {
+                fail("Result is NaN", position);
+            }
+        }
+        else
+        {
+            typedef typename wrapping<type>::natural natural;
+            if ((op == DIVIDE || op == MODULUS) && division_traps(left, right))
+            {
+                fail("Division traps", position);
+            }
+            if ((op == LEFT_SHIFT || op == RIGHT_SHIFT) &&
+                (right < 0 || (natural)right >= 8 * sizeof(natural)))
+            {
+                fail("Shift count out of range", position);
+            }
+            success = evaluate_operator_integer<type>(op, left, right, result);
+        }
+        if (!success)
+        {
+            fail("Parse error", position);
+        }
+        return result;
+    }
+
+    constexpr type operand()
+    /*! A literal, a parenthesized expression, or a unary operator and
+        its operand */
+    {
+        skip_whitespace();
+        size_t start = cursor;
+        type value = 0;
+        if (parse_literal(value))
+        {
+            return value;
+        }
+        operator_t op = lex_operator(UNARY);
+        if (op == INVALID_OP)
+        {
+            fail("Parse error", start);
+        }
+        if (op == OPEN_PAREN)
+        {
+            value = expression(1);
+            skip_whitespace();
+            if (lex_operator(BINARY) != CLOSE_PAREN)
+            {
+                fail("Parse error", cursor);
+            }
+            return value;
+        }
+        value = operand();
+        return apply(op, value, cursor);
+    }
+
+    constexpr type expression(int precedence)
+    /*! Operands joined by binary operators of at least precedence, left
+        to right */
+    {
+        type left = operand();
+        while (true)
+        {
+            skip_whitespace();
+            size_t start = cursor;
+            operator_t op = lex_operator(BINARY);
+            if (op == INVALID_OP)
+            {
+                fail("Parse error", start);
+            }
+            if (operator_table[op].arity != BINARY || operator_table[op].precedence < precedence)
+            {
+                cursor = start;
+                return left;
+            }
+            type right = expression(operator_table[op].precedence + 1);
+            left = apply(op, left, right, cursor);
+        }
+    }
+};
+
+}
+
+template <typename type>
+constexpr type eval(std::string_view expression)
+/*! The value of a constant expression, as bincalc would give it in the
+    mode of type */
+{
+    static_assert((std::is_integral_v<type> && !std::is_same_v<type, bool>) ||
+                  std::is_same_v<type, float> || std::is_same_v<type, double>,
+                  "eval needs an integer, float or double type");
+    eval_detail::parser<type> parse = {expression, 0};
+    type value = parse.expression(1);
+    parse.skip_whitespace();
+    if (parse.lex_operator(engine::BINARY) != engine::END_EXPRESSION)
+    {
+        parse.fail("Parse error", parse.cursor);
+    }
+    return value;
+}
+
+}
+
+#endif
@@ -1,6 +1,7 @@
 /*! A binary calculator for unsigned, signed, and floating point encodings.
     Features:
-        8,16,32,64 bit signed/unsigned and 32,64 bit floating point modes
+        8,16,32,64,128 bit signed/unsigned and 32,64 bit floating point modes
+        Packed 128-bit modes of 16, 8, 4 or 2 lanes (s8x16 through f64x2)
         Verbose mode showing computation steps
         Hexadecimal input and output
         Unary operators: ~ -
@@ -10,723 +11,2901 @@
 */
 
 #include <ctype.h>
+#include <stdarg.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <inttypes.h>
 #include <string.h>
+#include <strings.h>
 #include <errno.h>
+#include <math.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <getopt.h>
+#include <poll.h>
+#include <semaphore.h>
+#include <sys/uio.h>
+#include <time.h>
+#if defined(__x86_64__)
+#include <x86intrin.h>
+#endif
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <list>
+#include <map>
+#include <mutex>
+#include <algorithm>
+#include <array>
+#include <charconv>
 #include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 
 #include <readline/readline.h>
 #include <readline/history.h>
 
-enum encoding_t
-{
-    S8, S16, S32, S64,
-    U8, U16, U32, U64,
-    F32, F64,
-    NUM_ENCODINGS,
-    INVALID_ENCODING = -1,
-};
+#include "bincalc.h"
+#include "engine.h"
 
-struct encoded_value
+using namespace bincalc::engine;
+
+static bool parse_modes(char * mode_names, std::vector<encoding_t> & modes)
+/*! "all", or a comma separated list of modes */
 {
-    encoding_t encoding;
-    union
+    modes.clear();
+    if (strcmp(mode_names, "all") == 0)
     {
-        int8_t s8;
-        int16_t s16;
-        int32_t s32;
-        int64_t s64;
-
-        uint8_t u8;
-        uint16_t u16;
-        uint32_t u32;
-        uint64_t u64;
-
-        float f32;
-        double f64;
-    };
-};
-
-static const char * encoding_names[NUM_ENCODINGS] =
-{ "s8", "s16", "s32", "s64",
-  "u8", "u16", "u32", "u64",
-  "f32", "f64" };
-
-static const encoded_value INVALID_VALUE = {INVALID_ENCODING};
-
-enum operator_t
-{
-    OPEN_PAREN,
-    NOT,
-    NEGATE,
-    MULTIPLY,
-    DIVIDE,
-    MODULUS,
-    ADD,
-    SUBTRACT,
-    LEFT_SHIFT,
-    RIGHT_SHIFT,
-    AND,
-    XOR,
-    OR,
-    CLOSE_PAREN,
-    END_EXPRESSION,
-    NUM_OPS,
-    INVALID_OP = -1,
-};
+        for (int mode = 0; mode < NUM_ENCODINGS; mode++)
+        {
+            modes.push_back((encoding_t)mode);
+        }
+        return true;
+    }
+    for (char * name = strtok(mode_names, ","); name; name = strtok(NULL, ","))
+    {
+        encoding_t mode = parse_mode(name);
+        if (mode == INVALID_ENCODING)
+        {
+            return false;
+        }
+        modes.push_back(mode);
+    }
+    return !modes.empty();
+}
 
-enum arity_t
+struct cache_entry
 {
-    UNARY,
-    BINARY,
-    SENTINEL,
-};
-
-static struct
-{
-    int precedence;
-    arity_t arity;
-    const char * identifier;
-} operator_table[] =
-{ { 8, UNARY, "(" },
-  { 7, UNARY, "~" },
-  { 7, UNARY, "-" },
-  { 6, BINARY, "*" },
-  { 6, BINARY, "/" },
-  { 6, BINARY, "%" },
-  { 5, BINARY, "+" },
-  { 5, BINARY, "-" },
-  { 4, BINARY, "<<" },
-  { 4, BINARY, ">>" },
-  { 3, BINARY, "&" },
-  { 2, BINARY, "^" },
-  { 1, BINARY, "|" },
-  { 0, SENTINEL, ")" },
-  { 0, SENTINEL, "\0" } };
-
-struct parse_error : std::runtime_error
-{
-    parse_error() : std::runtime_error("Parse error") {}
+    std::string key;
+    std::string output;
 };
 
-struct range_error : std::runtime_error
+struct result_cache
+/*! The output of recently evaluated expressions, most recent first.
+    The key is the mode and the token stream, so expressions that differ
+    only in whitespace share an entry. Only successes are kept, since an
+    error's caret depends on the exact text */
 {
-    range_error() : std::runtime_error("Value out of range") {}
+    size_t capacity;
+    std::list<cache_entry> entries;
+    std::unordered_map<std::string, std::list<cache_entry>::iterator> index;
+    std::string key; /* Scratch for building keys */
+    uint64_t hits;
+    uint64_t misses;
 };
 
-static bool verbose;
-
-static int max(int a, int b)
-{
-    return a > b ? a : b;
-}
-
-static void skip_whitespace(char *& cursor)
+static void cache_key(std::string & key, encoding_t mode, const arena_vector<token> & tokens)
 {
-    while (isspace(*cursor))
+    key.clear();
+    key += (char)mode;
+    int size = encoding_sizes[mode];
+    for (const token & tok : tokens)
     {
-        cursor++;
-    }
-}
-
-static operator_t parse_operator(char *& cursor, arity_t arity,
-                                 operator_t sentinel = INVALID_OP)
-{
-    skip_whitespace(cursor);
-    for (int op = 0; op < NUM_OPS; op++)
-    {
-        if (operator_table[op].arity != arity && op != sentinel)
+        key += (char)tok.kind;
+        if (tok.kind == OPERATOR_TOKEN)
         {
-            continue;
+            key += (char)tok.op;
         }
-        const char * identifier = operator_table[op].identifier;
-        int identifier_size = max(1, strlen(identifier));
-        if (strncmp(cursor, identifier, identifier_size) == 0)
+        else if (tok.kind == VALUE_TOKEN)
         {
-            cursor += identifier_size;
-            return (operator_t)op;
+            key.append((const char *)&tok.value.u128, size);
         }
     }
-    throw parse_error();
 }
 
-static int64_t parse_int(char *& cursor, int64_t min, int64_t max)
+static const std::string * cache_lookup(result_cache & cache, const std::string & key)
 {
-    int64_t value = strtoll(cursor, &cursor, 10);
-    if (value < min || value > max)
+    auto found = cache.index.find(key);
+    if (found == cache.index.end())
     {
-        errno = ERANGE;
+        cache.misses++;
+        return NULL;
     }
-    return value;
+    cache.hits++;
+    cache.entries.splice(cache.entries.begin(), cache.entries, found->second);
+    return &found->second->output;
 }
 
-static uint64_t parse_uint(char *& cursor, uint64_t max)
+static void cache_insert(result_cache & cache, const std::string & key, const char * output,
+                         size_t size)
 {
-    if (cursor[0] == '-' && isdigit(cursor[1]))
+    if (cache.capacity == 0)
     {
-        errno = ERANGE;
-        return 0;
+        return;
     }
-    uint64_t value = strtoull(cursor, &cursor, 10);
-    if (value > max)
+    if (cache.entries.size() == cache.capacity)
     {
-        errno = ERANGE;
+        cache.index.erase(cache.entries.back().key);
+        cache.entries.pop_back();
     }
-    return value;
+    cache.entries.push_front(cache_entry());
+    cache.entries.front().key = key;
+    cache.entries.front().output.assign(output, size);
+    cache.index[key] = cache.entries.begin();
 }
 
-static int digit_to_int(int c)
+enum phase_t
+{
+    PARSE_PHASE,    /* Lexing, compiling, and reading row values */
+    EVALUATE_PHASE,
+    FORMAT_PHASE,
+    IO_PHASE,       /* Reading batch input and writing output */
+    NUM_PHASES,
+};
+
+static const char * phase_names[NUM_PHASES] = {"parse", "evaluate", "format", "io"};
+
+static const char * operator_names[NUM_OPS] =
+{ "paren", "not", "negate", "multiply", "divide", "modulus", "add", "subtract",
+  "left_shift", "right_shift", "and", "xor", "or", "close_paren", "end" };
+
+struct stats
+/*! Counters for --stats. Each thread keeps its own, summed at exit */
 {
-    return '0' <= c && c <= '9' ? c - '0' :
-           'a' <= c && c <= 'f' ? c - 'a' + 10 :
-           'A' <= c && c <= 'F' ? c - 'A' + 10 : 0;
+    uint64_t lines;
+    uint64_t results;
+    uint64_t parse_errors;
+    uint64_t range_errors;
+    uint64_t division_errors;
+    uint64_t operators[NUM_OPS];
+    uint64_t cycles[NUM_PHASES];
+};
+
+static uint64_t read_cycles()
+/*! The time stamp counter where there is one, or else nanoseconds */
+{
+#if defined(__x86_64__)
+    return __rdtsc();
+#else
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * UINT64_C(1000000000) + now.tv_nsec;
+#endif
 }
 
-static uint64_t strtox(char *& cursor, int max_digits)
-/*! Unfortunately, strtol forces you to use "0x" as a prefix, so
-    rather than hack around it; I'm going to reimplement it with
-    an "x" prefix */
+static void add_stats(stats & total, const stats & part)
 {
-    if (cursor[0] != 'x' || !isxdigit(cursor[1]))
+    total.lines += part.lines;
+    total.results += part.results;
+    total.parse_errors += part.parse_errors;
+    total.range_errors += part.range_errors;
+    total.division_errors += part.division_errors;
+    for (int op = 0; op < NUM_OPS; op++)
     {
-        return 0;
+        total.operators[op] += part.operators[op];
     }
-    cursor++;
-    while (*cursor == '0')
+    for (int phase = 0; phase < NUM_PHASES; phase++)
     {
-        cursor++;
+        total.cycles[phase] += part.cycles[phase];
     }
-    if (!isxdigit(*cursor))
+}
+
+static void count_operators(stats * counters, const program & prog, size_t end, uint64_t times)
+/*! Count the operators among prog's first end instructions, evaluated times over */
+{
+    if (!counters)
     {
-        return 0;
+        return;
     }
-    uint64_t value = 0;
-    for (int digits = 0; digits < max_digits; digits++)
+    for (size_t pc = 0; pc < end && pc < prog.code.size(); pc++)
     {
-        value += digit_to_int(*cursor);
-        cursor++;
-        if (!isxdigit(*cursor))
+        if (prog.code[pc].opcode == OPERATOR)
         {
-            return value;
+            counters->operators[prog.code[pc].operand] += times;
         }
-        value <<= 4;
     }
-    errno = ERANGE;
-    return 0;
 }
 
-static encoded_value parse_value(char *& cursor, encoding_t mode)
+struct line_span
 {
-    skip_whitespace(cursor);
-    encoded_value value;
-    value.encoding = mode;
+    const char * text; /* Not NUL-terminated */
+    size_t size;
+};
 
-    char * old_cursor = cursor;
-    if (*cursor == 'x')
-    {
-        switch (mode)
-        {
-        case S8:
-        case U8:
-            value.u8 = strtox(cursor, 2);
-            break;
-        case S16:
-        case U16:
-            value.u16 = strtox(cursor, 4);
-            break;
-        case S32:
-        case U32:
-        case F32:
-            value.u32 = strtox(cursor, 8);
-            break;
-        case S64:
-        case U64:
-        case F64:
-            value.u64 = strtox(cursor, 16);
-            break;
-        default:
-            fprintf(stderr, "parse_value: Invalid mode: %d\n", (int)mode);
-            break;
-        }
-    }
-    else
-    {
-        switch (mode)
-        {
-        case S8:
-            value.s8 = parse_int(cursor, INT8_MIN, INT8_MAX);
-            break;
-        case S16:
-            value.s16 = parse_int(cursor, INT16_MIN, INT16_MAX);
-            break;
-        case S32:
-            value.s32 = parse_int(cursor, INT32_MIN, INT32_MAX);
-            break;
-        case S64:
-            value.s64 = parse_int(cursor, INT64_MIN, INT64_MAX);
-            break;
-        case U8:
-            value.u8 = parse_uint(cursor, UINT8_MAX);
-            break;
-        case U16:
-            value.u16 = parse_uint(cursor, UINT16_MAX);
-            break;
-        case U32:
-            value.u32 = parse_uint(cursor, UINT32_MAX);
-            break;
-        case U64:
-            value.u64 = parse_uint(cursor, UINT64_MAX);
-            break;
-        case F32:
-            value.f32 = strtof(cursor, &cursor);
-            break;
-        case F64:
-            value.f64 = strtod(cursor, &cursor);
-            break;
-        default:
-            fprintf(stderr, "parse_value: Invalid mode: %d\n", (int)mode);
-            break;
-        }
-    }
+struct table
+/*! --csv and --tsv: rows are delimited fields under a header row that
+    names them, and are written back with the result as one more field */
+{
+    char delimiter;
+    const char * result_name;
+    bool bound;              /* Once the header has been read */
+    std::vector<int> fields; /* Field of each variable */
+};
+
+struct error_mark
+/*! Where a message starts in err, and how much of out goes before it */
+{
+    size_t out;
+    size_t err;
+};
+
+struct context
+/*! Everything needed to evaluate lines independently of other threads.
+    Output collects in out and err until the caller writes it */
+{
+    encoding_t mode;
+    bool verbose;
+    row_block * rows; /* Row mode, or NULL for expressions */
+    result_cache * cache; /* Or NULL */
+    const std::vector<encoding_t> * modes; /* To evaluate each line in several, or NULL */
+    stats * counters; /* Or NULL */
+    FILE * trace_file; /* For --trace, or NULL */
+    table * columns; /* With --csv or --tsv, or NULL */
+    uint64_t line; /* Number of the line being evaluated */
+    arena pool; /* Reset for each expression */
+    output_buffer out;
+    std::string err;
+    std::vector<error_mark> err_marks; /* One per run of messages in err */
+    trace_buffer trace; /* Steps of the current evaluation, with -v or --trace */
+    std::string trace_records; /* Waiting for trace_file */
+    std::vector<uint64_t> row_lines; /* Line of each pending row, for its errors and trace */
+    std::vector<line_span> row_text; /* Each pending row, with --csv or --tsv */
+    std::vector<line_span> fields; /* Of the row being read, with --csv or --tsv */
+};
+
+struct trace_record
+/*! Heads each line's steps in a --trace file, after TRACE_MAGIC */
+{
+    uint64_t line;
+    uint64_t count;
+};
+
+static const char TRACE_MAGIC[8] = {'b', 'c', 't', 'r', 'a', 'c', 'e', '2'};
+
+static trace_buffer * tracer(context & ctx)
+/*! Where evaluate_program should record steps, if anywhere */
+{
+    return ctx.verbose || ctx.trace_file ? &ctx.trace : NULL;
+}
 
-    if (errno == ERANGE)
+static void emit_trace(context & ctx, uint64_t line)
+/*! Render the steps just recorded into the output with -v, and queue
+    them for the trace file with --trace */
+{
+    if (ctx.trace.steps.empty())
     {
-        errno = 0;
-        cursor = old_cursor;
-        throw range_error();
+        return;
     }
-    if (old_cursor == cursor)
+    if (ctx.verbose)
     {
-        return INVALID_VALUE;
+        render_trace(ctx.out, ctx.trace.steps.data(), ctx.trace.steps.size());
     }
-    else
+    if (ctx.trace_file)
     {
-        return value;
+        trace_record record = {line, ctx.trace.steps.size()};
+        ctx.trace_records.append((const char *)&record, sizeof record);
+        ctx.trace_records.append((const char *)ctx.trace.steps.data(),
+                                 ctx.trace.steps.size() * sizeof(trace_step));
     }
+    ctx.trace.steps.clear();
 }
 
-static char * format_hex(encoded_value value)
+static uint64_t start_timer(const context & ctx)
 {
-    static char string_buf[256];
-    static int index = 0;
-    index = (index + 32) % 256;
-    char * string = &string_buf[index];
-
-    switch (value.encoding)
-    {
-    case S8:
-    case U8:
-        sprintf(string, "x%02" PRIx8, value.u8);
-        break;
-    case S16:
-    case U16:
-        sprintf(string, "x%04" PRIx16, value.u16);
-        break;
-    case S32:
-    case U32:
-    case F32:
-        sprintf(string, "x%08" PRIx32, value.u32);
-        break;
-    case S64:
-    case U64:
-    case F64:
-        sprintf(string, "x%016" PRIx64, value.u64);
-        break;
-    default:
-        fprintf(stderr, "Invalid encoding: %d\n", value.encoding);
-        break;
-    }
-    return string;
+    return ctx.counters ? read_cycles() : 0;
 }
 
-static char * format_dec(encoded_value value)
+static uint64_t charge(context & ctx, phase_t phase, uint64_t start)
+/*! Add the time since start to phase; returns the time now, for
+    timing the next phase from */
 {
-    static char string_buf[256];
-    static int index = 0;
-    index = (index + 32) % 256;
-    char * string = &string_buf[index];
-
-    switch (value.encoding)
+    if (!ctx.counters)
     {
-    case S8:
-        sprintf(string, "%" PRId8, value.s8);
-        break;
-    case S16:
-        sprintf(string, "%" PRId16, value.s16);
-        break;
-    case S32:
-        sprintf(string, "%" PRId32, value.s32);
-        break;
-    case S64:
-        sprintf(string, "%" PRId64, value.s64);
-        break;
-    case U8:
-        sprintf(string, "%" PRIu8, value.u8);
-        break;
-    case U16:
-        sprintf(string, "%" PRIu16, value.u16);
-        break;
-    case U32:
-        sprintf(string, "%" PRIu32, value.u32);
-        break;
-    case U64:
-        sprintf(string, "%" PRIu64, value.u64);
-        break;
-    case F32:
-        sprintf(string, "%f", value.f32);
-        break;
-    case F64:
-        sprintf(string, "%lf", value.f64);
-        break;
-    default:
-        fprintf(stderr, "Invalid encoding: %d\n", value.encoding);
-        break;
+        return 0;
     }
-    return string;
+    uint64_t now = read_cycles();
+    ctx.counters->cycles[phase] += now - start;
+    return now;
 }
 
-template <typename type>
-static bool evaluate_operator_integer(operator_t op, type value, type & result)
+static void write_output(context & ctx)
+/*! Each run of messages goes to stderr after the output before it, so
+    the two stay in order when they go to the same place */
 {
-    bool success = true;
-    switch (op)
+    uint64_t start = start_timer(ctx);
+    const std::string & out = ctx.out.text;
+    size_t written = 0;
+    for (size_t index = 0; index < ctx.err_marks.size(); index++)
     {
-    case NOT:
-        result = ~value;
-        break;
-    case NEGATE:
-        result = -value;
-        break;
-    default:
-        success = false;
-        break;
+        const error_mark & mark = ctx.err_marks[index];
+        size_t err_end = index + 1 < ctx.err_marks.size() ? ctx.err_marks[index + 1].err
+                                                           : ctx.err.size();
+        fwrite(out.data() + written, 1, mark.out - written, stdout);
+        fflush(stdout);
+        fwrite(ctx.err.data() + mark.err, 1, err_end - mark.err, stderr);
+        written = mark.out;
     }
-    return success;
+    fwrite(out.data() + written, 1, out.size() - written, stdout);
+    ctx.out.text.clear();
+    ctx.err.clear();
+    ctx.err_marks.clear();
+    if (!ctx.trace_records.empty())
+    {
+        fwrite(ctx.trace_records.data(), 1, ctx.trace_records.size(), ctx.trace_file);
+        ctx.trace_records.clear();
+    }
+    charge(ctx, IO_PHASE, start);
 }
 
-template <typename type>
-static bool evaluate_operator_real(operator_t op, type value, type & result)
+static void mark_error(context & ctx)
+/*! Note where the message about to be queued falls in the output */
 {
-    bool success = true;
-    switch (op)
+    if (ctx.err_marks.empty() || ctx.err_marks.back().out != ctx.out.text.size())
     {
-    case NEGATE:
-        result = -value;
-        break;
-    default:
-        success = false;
-        break;
+        ctx.err_marks.push_back({ctx.out.text.size(), ctx.err.size()});
     }
-    return success;
 }
 
-static encoded_value evaluate_operator(operator_t op, encoded_value value)
+static void report_error(context & ctx, const char * input, const char * cursor,
+                         status_t status, const char * label = NULL)
+/*! Queue the caret line and message, to be written along with the rest
+    of the output */
 {
-    bool success = false;
-    encoded_value result = {};
-    result.encoding = value.encoding;
-    switch (result.encoding)
+    mark_error(ctx);
+    ctx.err += "  ";
+    ctx.err.append(cursor - input, ' ');
+    ctx.err += "^\n";
+    if (label)
     {
-    case S8:
-        success = evaluate_operator_integer<int8_t>(op, value.s8, result.s8);
-        break;
-    case S16:
-        success = evaluate_operator_integer<int16_t>(op, value.s16, result.s16);
-        break;
-    case S32:
-        success = evaluate_operator_integer<int32_t>(op, value.s32, result.s32);
-        break;
-    case S64:
-        success = evaluate_operator_integer<int64_t>(op, value.s64, result.s64);
-        break;
-    case U8:
-        success = evaluate_operator_integer<uint8_t>(op, value.u8, result.u8);
-        break;
-    case U16:
-        success = evaluate_operator_integer<uint16_t>(op, value.u16, result.u16);
-        break;
-    case U32:
-        success = evaluate_operator_integer<uint32_t>(op, value.u32, result.u32);
-        break;
-    case U64:
-        success = evaluate_operator_integer<uint64_t>(op, value.u64, result.u64);
-        break;
-    case F32:
-        success = evaluate_operator_real<float>(op, value.f32, result.f32);
-        break;
-    case F64:
-        success = evaluate_operator_real<double>(op, value.f64, result.f64);
-        break;
-    default:
-        fprintf(stderr, "evaluate_operator: invalid encoding: %d\n", (int)result.encoding);
-        break;
+        ctx.err += label;
+        ctx.err += ": ";
     }
-
-    if (success)
+    ctx.err += status_message(status);
+    ctx.err += '\n';
+    if (ctx.counters)
     {
-        if (verbose)
+        if (status == RANGE_ERROR)
         {
-            printf("%s(%s) = %s (%s%s = %s)\n",
-                   operator_table[op].identifier, format_dec(value), format_dec(result),
-                   operator_table[op].identifier, format_hex(value), format_hex(result));
+            ctx.counters->range_errors++;
+        }
+        else if (status == DIVISION_ERROR)
+        {
+            ctx.counters->division_errors++;
+        }
+        else
+        {
+            ctx.counters->parse_errors++;
         }
-        return result;
-    }
-    else
-    {
-        throw parse_error();
     }
 }
 
-template <typename type>
-static bool evaluate_operator_integer(operator_t op, type left, type right, type & result)
+static void report_program_error(context & ctx, const program & prog, size_t pc,
+                                 status_t status, const char * label = NULL)
 {
-    bool success = true;
-    switch (op)
-    {
-    case ADD:
-        result = left + right;
-        break;
-    case SUBTRACT:
-        result = left - right;
-        break;
-    case MULTIPLY:
-        result = left * right;
-        break;
-    case DIVIDE:
-        result = left / right;
-        break;
-    case MODULUS:
-        result = left % right;
-        break;
-    case LEFT_SHIFT:
-        result = left << right;
-        break;
-    case RIGHT_SHIFT:
-        result = left >> right;
-        break;
-    case AND:
-        result = left & right;
-        break;
-    case OR:
-        result = left | right;
-        break;
-    case XOR:
-        result = left ^ right;
-        break;
-    default:
-        success = false;
-        break;
-    }
-    return success;
+    mark_error(ctx);
+    append(ctx.err, "  %s\n", prog.source.c_str());
+    report_error(ctx, prog.source.c_str(), prog.source.c_str() + prog.positions[pc], status,
+                 label);
 }
 
-template <typename type>
-static bool evaluate_operator_real(operator_t op, type left, type right, type & result)
+enum
 {
-    bool success = true;
-    switch (op)
+    LABEL_SIZE = 32,
+};
+
+static const char * line_label(char * label, uint64_t line)
+/*! "line N", so that a row's error can be matched to its input */
+{
+    snprintf(label, LABEL_SIZE, "line %" PRIu64, line);
+    return label;
+}
+
+static void report_trapped_row(context & ctx, const row_block & rows, const char * columns,
+                               int row, const char * label)
+/*! The block kernels only flag a row whose division would trap, so
+    evaluate it again on its own to find which division it was */
+{
+    const program & prog = *rows.prog;
+    std::vector<encoded_value> values(prog.variables.size());
+    std::vector<stack_slot> stack(max(1, stack_slots(prog)));
+    for (size_t index = 0; index < values.size(); index++)
     {
-    case ADD:
-        result = left + right;
-        break;
-    case SUBTRACT:
-        result = left - right;
-        break;
-    case MULTIPLY:
-        result = left * right;
-        break;
-    case DIVIDE:
-        result = left / right;
-        break;
-    default:
-        success = false;
-        break;
+        values[index] = lane_value(rows, columns + index * BLOCK_SIZE * LANE_BYTES, row);
     }
-    return success;
+    encoded_value result;
+    size_t pc = 0;
+    status_t status = evaluate_program(prog, values.data(), stack.data(), result, pc, NULL);
+    report_program_error(ctx, prog, pc, status == NO_ERROR ? DIVISION_ERROR : status, label);
 }
 
-static encoded_value evaluate_operator(operator_t op, encoded_value left, encoded_value right)
+static void print_result(context & ctx, encoded_value result)
 {
-    encoded_value result = {};
-    if (left.encoding != right.encoding)
+    /* "dec (hex)\n" */
+    char string[2 * FORMAT_SIZE + 4];
+    int size = format_dec(result, string, ctx.out.float_format);
+    string[size++] = ' ';
+    string[size++] = '(';
+    size += format_hex(result, &string[size]);
+    string[size++] = ')';
+    string[size++] = '\n';
+    ctx.out.text.append(string, size);
+    if (ctx.counters)
     {
-        fprintf(stderr, "Mixed types not supported\n");
-        return INVALID_VALUE;
+        ctx.counters->results++;
     }
+}
 
-    bool success = false;
-    result.encoding = left.encoding;
-    switch (result.encoding)
+static void append_field(context & ctx, const char * field, size_t size)
+/*! Quoted if it holds the delimiter, as packed values' lists do in CSV */
+{
+    std::string & text = ctx.out.text;
+    char delimiter = ctx.columns->delimiter;
+    if (!memchr(field, delimiter, size) && !memchr(field, '"', size))
     {
-    case S8:
-        success = evaluate_operator_integer<int8_t>(op, left.s8, right.s8, result.s8);
-        break;
-    case S16:
-        success = evaluate_operator_integer<int16_t>(op, left.s16, right.s16, result.s16);
-        break;
-    case S32:
-        success = evaluate_operator_integer<int32_t>(op, left.s32, right.s32, result.s32);
-        break;
-    case S64:
-        success = evaluate_operator_integer<int64_t>(op, left.s64, right.s64, result.s64);
-        break;
-    case U8:
-        success = evaluate_operator_integer<uint8_t>(op, left.u8, right.u8, result.u8);
-        break;
-    case U16:
-        success = evaluate_operator_integer<uint16_t>(op, left.u16, right.u16, result.u16);
-        break;
-    case U32:
-        success = evaluate_operator_integer<uint32_t>(op, left.u32, right.u32, result.u32);
-        break;
-    case U64:
-        success = evaluate_operator_integer<uint64_t>(op, left.u64, right.u64, result.u64);
-        break;
-    case F32:
-        success = evaluate_operator_real<float>(op, left.f32, right.f32, result.f32);
-        break;
-    case F64:
-        success = evaluate_operator_real<double>(op, left.f64, right.f64, result.f64);
-        break;
-    default:
-        fprintf(stderr, "evaluate_operator: invalid encoding: %d\n", (int)result.encoding);
-        break;
+        text.append(field, size);
+        return;
     }
-    if (success)
+    text += '"';
+    for (size_t index = 0; index < size; index++)
     {
-        if (verbose)
+        if (field[index] == '"')
         {
-            printf("%s %s %s = %s (%s %s %s = %s)\n",
-                   format_dec(left), operator_table[op].identifier, format_dec(right), format_dec(result),
-                   format_hex(left), operator_table[op].identifier, format_hex(right), format_hex(result));
+            text += '"';
         }
-        return result;
-    }
-    else
-    {
-        throw parse_error();
+        text += field[index];
     }
+    text += '"';
 }
 
-static encoded_value compute_value(char *& cursor, encoding_t mode);
-
-static encoded_value compute_expression(char *& cursor, encoding_t mode, operator_t sentinel,
-                                        int min_precedence = 0, operator_t * op_out = NULL)
+static void print_table_row(context & ctx, line_span row, const encoded_value * result)
+/*! The row as it was read, then the result as one more field, left
+    empty if the row failed */
 {
-    encoded_value value = compute_value(cursor, mode);
-    operator_t op = parse_operator(cursor, BINARY, sentinel);
-    while (true)
+    ctx.out.text.append(row.text, row.size);
+    ctx.out.text += ctx.columns->delimiter;
+    if (result)
     {
-        int precedence = operator_table[op].precedence;
-        if (precedence <= min_precedence)
+        char string[FORMAT_SIZE];
+        append_field(ctx, string, format_dec(*result, string, ctx.out.float_format));
+        if (ctx.counters)
         {
-            break;
+            ctx.counters->results++;
         }
-        operator_t next_op;
-        encoded_value next_value = compute_expression(cursor, mode, sentinel, precedence, &next_op);
-        value = evaluate_operator(op, value, next_value);
-        op = next_op;
-    }
-    if (op_out)
-    {
-        *op_out = op;
     }
-    return value;
+    ctx.out.text += '\n';
 }
 
-static encoded_value compute_value(char *& cursor, encoding_t mode)
+static void print_row(context & ctx, int row, const encoded_value * result)
+/*! A pending row's result, or with --csv or --tsv its row, which is
+    written even if result is NULL for a failure */
 {
-    encoded_value value = parse_value(cursor, mode);
-    if (value.encoding != INVALID_ENCODING)
-    {
-        return value;
-    }
-    operator_t unary_op = parse_operator(cursor, UNARY);
-    if (unary_op == OPEN_PAREN)
-    {
-        return compute_expression(cursor, mode, CLOSE_PAREN);
-    }
-    else if (operator_table[unary_op].arity == UNARY)
+    if (ctx.columns)
     {
-        encoded_value result = compute_value(cursor, mode);
-        return evaluate_operator(unary_op, result);
+        print_table_row(ctx, ctx.row_text[row], result);
     }
-    else
+    else if (result)
     {
-        throw parse_error();
+        print_result(ctx, *result);
     }
 }
 
-static encoding_t parse_mode(char * mode_name)
+static bool flush_rows(context & ctx)
+/*! Evaluate and print all pending rows; returns false if any failed */
 {
-    for (int mode = 0; mode < NUM_ENCODINGS; mode++)
+    row_block & rows = *ctx.rows;
+    const program & prog = *rows.prog;
+    int count = rows.count;
+    rows.count = 0;
+    size_t pc = 0;
+    char label[LABEL_SIZE];
+    uint64_t start = start_timer(ctx);
+    if (tracer(ctx))
     {
-        if (strcmp(mode_name, encoding_names[mode]) == 0)
+        /* Steps are recorded by the scalar evaluator, one row at a time */
+        bool success = true;
+        std::vector<encoded_value> values(prog.variables.size());
+        std::vector<stack_slot> stack(stack_slots(prog));
+        for (int row = 0; row < count; row++)
         {
-            return (encoding_t)mode;
+            for (size_t index = 0; index < values.size(); index++)
+            {
+                values[index] = lane_value(rows, rows.columns + index * BLOCK_SIZE * LANE_BYTES, row);
+            }
+            encoded_value result;
+            status_t status = evaluate_program(prog, values.data(), stack.data(), result, pc,
+                                               &ctx.trace);
+            emit_trace(ctx, ctx.row_lines[row]);
+            if (status != NO_ERROR)
+            {
+                count_operators(ctx.counters, prog, pc + 1, 1);
+                report_program_error(ctx, prog, pc, status, line_label(label, ctx.row_lines[row]));
+                start = charge(ctx, EVALUATE_PHASE, start);
+                print_row(ctx, row, NULL);
+                success = false;
+                continue;
+            }
+            count_operators(ctx.counters, prog, prog.code.size(), 1);
+            start = charge(ctx, EVALUATE_PHASE, start);
+            print_row(ctx, row, &result);
+            start = charge(ctx, FORMAT_PHASE, start);
         }
+        return success;
     }
-    return INVALID_ENCODING;
-}
 
-static bool handle_input(char * input, encoding_t mode)
-{
-    char * cursor = input;
-    try
+    if (!evaluate_rows(prog, rows.columns, rows.stack, count, pc, rows.trapped))
     {
-        encoded_value result = compute_expression(cursor, mode, END_EXPRESSION);
-        printf("%s (%s)\n", format_dec(result), format_hex(result));
-        return true;
+        count_operators(ctx.counters, prog, pc + 1, count);
+        for (int row = 0; row < count; row++)
+        {
+            report_program_error(ctx, prog, pc, PARSE_ERROR, line_label(label, ctx.row_lines[row]));
+            print_row(ctx, row, NULL);
+        }
+        charge(ctx, EVALUATE_PHASE, start);
+        return false;
     }
-    catch (std::exception & error)
+    count_operators(ctx.counters, prog, prog.code.size(), count);
+    start = charge(ctx, EVALUATE_PHASE, start);
+    bool success = true;
+    for (int row = 0; row < count; row++)
     {
-        fprintf(stderr, "  ");
-        for (; cursor > input; cursor--)
+        if (rows.trapped[row])
         {
-            fprintf(stderr, " ");
+            report_trapped_row(ctx, rows, rows.columns, row, line_label(label, ctx.row_lines[row]));
+            print_row(ctx, row, NULL);
+            success = false;
+            continue;
         }
-        fprintf(stderr, "^\n");
-        fprintf(stderr, "%s\n", error.what());
-        return false;
+        encoded_value result = lane_value(rows, rows.stack, row);
+        print_row(ctx, row, &result);
     }
+    charge(ctx, FORMAT_PHASE, start);
+    return success;
+}
+
+static void split_fields(const char * input, const char * end, char delimiter,
+                         std::vector<line_span> & fields)
+/*! Slice the line into fields where they lie, without copying them. A
+    field in double quotes may hold the delimiter, and its slice is what
+    is between the quotes */
+{
+    fields.clear();
+    const char * cursor = input;
+    while (true)
+    {
+        line_span field = {cursor, 0};
+        if (cursor < end && *cursor == '"')
+        {
+            /* Up to the closing quote; "" stands for a quote inside */
+            const char * quote = cursor + 1;
+            while (quote < end && (*quote != '"' || (quote + 1 < end && quote[1] == '"')))
+            {
+                quote += *quote == '"' ? 2 : 1;
+            }
+            field.text = cursor + 1;
+            field.size = quote - field.text;
+            cursor = std::min(quote + 1, end);
+        }
+        const char * next = (const char *)memchr(cursor, delimiter, end - cursor);
+        if (field.text == cursor)
+        {
+            field.size = (next ? next : end) - cursor;
+        }
+        fields.push_back(field);
+        if (!next)
+        {
+            return;
+        }
+        cursor = next + 1;
+    }
+}
+
+static line_span trim_line(const char * input, const char * end)
+/*! Without the carriage return of a CRLF line ending */
+{
+    line_span line = {input, (size_t)(end - input)};
+    if (line.size > 0 && input[line.size - 1] == '\r')
+    {
+        line.size--;
+    }
+    return line;
+}
+
+static void handle_header(const char * input, const char * end, context & ctx)
+/*! Bind each variable to the field of the same name, and write the
+    header back with the result's field added. A variable with no field
+    to bind is fatal, as no row could be evaluated */
+{
+    table & columns = *ctx.columns;
+    const program & prog = *ctx.rows->prog;
+    line_span header = trim_line(input, end);
+    split_fields(header.text, header.text + header.size, columns.delimiter, ctx.fields);
+    columns.fields.assign(prog.variables.size(), -1);
+    for (size_t index = 0; index < prog.variables.size(); index++)
+    {
+        const token & name = prog.tokens[prog.variables[index]];
+        const char * text = prog.source.data() + name.position;
+        size_t size = name.end - name.position;
+        for (size_t field = 0; field < ctx.fields.size(); field++)
+        {
+            const char * cursor = ctx.fields[field].text;
+            const char * field_end = cursor + ctx.fields[field].size;
+            skip_whitespace(cursor, field_end);
+            while (field_end > cursor && isspace(field_end[-1]))
+            {
+                field_end--;
+            }
+            if ((size_t)(field_end - cursor) == size && memcmp(cursor, text, size) == 0)
+            {
+                columns.fields[index] = field;
+                break;
+            }
+        }
+        if (columns.fields[index] < 0)
+        {
+            write_output(ctx);
+            fprintf(stderr, "No field named %.*s in the header\n", (int)size, text);
+            exit(1);
+        }
+    }
+    columns.bound = true;
+    ctx.out.text.append(header.text, header.size);
+    ctx.out.text += columns.delimiter;
+    append_field(ctx, columns.result_name, strlen(columns.result_name));
+    ctx.out.text += '\n';
+}
+
+static bool handle_table_row(const char * input, const char * end, context & ctx)
+/*! Like handle_row, but with each variable's value taken from its field */
+{
+    row_block & rows = *ctx.rows;
+    const program & prog = *rows.prog;
+    const table & columns = *ctx.columns;
+    int size = encoding_sizes[prog.mode];
+    uint64_t start = start_timer(ctx);
+    line_span line = trim_line(input, end);
+    split_fields(line.text, line.text + line.size, columns.delimiter, ctx.fields);
+    const char * cursor = line.text + line.size;
+    status_t status = NO_ERROR;
+    for (size_t index = 0; index < prog.variables.size(); index++)
+    {
+        if ((size_t)columns.fields[index] >= ctx.fields.size())
+        {
+            status = PARSE_ERROR;
+            break;
+        }
+        const line_span & field = ctx.fields[columns.fields[index]];
+        const char * field_end = field.text + field.size;
+        cursor = field.text;
+        encoded_value value;
+        status = parse_value(cursor, field_end, prog.mode, value);
+        if (status == NO_ERROR && value.encoding == INVALID_ENCODING)
+        {
+            status = PARSE_ERROR;
+        }
+        if (status == NO_ERROR)
+        {
+            skip_whitespace(cursor, field_end);
+            status = cursor == field_end ? NO_ERROR : PARSE_ERROR;
+        }
+        if (status != NO_ERROR)
+        {
+            break;
+        }
+        memcpy(rows.columns + index * BLOCK_SIZE * LANE_BYTES + rows.count * size,
+               &value.u128, size);
+    }
+    charge(ctx, PARSE_PHASE, start);
+    if (status != NO_ERROR)
+    {
+        /* Rows pending ahead of this one go first, to keep them in order */
+        flush_rows(ctx);
+        char label[LABEL_SIZE];
+        report_error(ctx, input, cursor, status, line_label(label, ctx.line));
+        print_table_row(ctx, line, NULL);
+        return false;
+    }
+
+    ctx.row_lines.resize(BLOCK_SIZE);
+    ctx.row_lines[rows.count] = ctx.line;
+    ctx.row_text.resize(BLOCK_SIZE);
+    ctx.row_text[rows.count] = line;
+    rows.count++;
+    if (rows.count == BLOCK_SIZE)
+    {
+        return flush_rows(ctx);
+    }
+    return true;
+}
+
+static bool handle_row(const char * input, const char * end, context & ctx)
+/*! Bind one whitespace or comma separated value per variable. The row
+    is evaluated once the block fills up or is flushed */
+{
+    row_block & rows = *ctx.rows;
+    const program & prog = *rows.prog;
+    const char * cursor = input;
+    int size = encoding_sizes[prog.mode];
+    uint64_t start = start_timer(ctx);
+    status_t status = NO_ERROR;
+    for (size_t index = 0; index < prog.variables.size(); index++)
+    {
+        encoded_value value;
+        status = parse_value(cursor, end, prog.mode, value);
+        if (status == NO_ERROR && value.encoding == INVALID_ENCODING)
+        {
+            status = PARSE_ERROR;
+        }
+        if (status != NO_ERROR)
+        {
+            break;
+        }
+        memcpy(rows.columns + index * BLOCK_SIZE * LANE_BYTES + rows.count * size,
+               &value.u128, size);
+        skip_whitespace(cursor, end);
+        if (cursor < end && *cursor == ',')
+        {
+            cursor++;
+        }
+    }
+    if (status == NO_ERROR)
+    {
+        skip_whitespace(cursor, end);
+        if (cursor != end)
+        {
+            status = PARSE_ERROR;
+        }
+    }
+    charge(ctx, PARSE_PHASE, start);
+    if (status != NO_ERROR)
+    {
+        /* Rows pending ahead of this one go first, to keep them in order */
+        flush_rows(ctx);
+        char label[LABEL_SIZE];
+        report_error(ctx, input, cursor, status, line_label(label, ctx.line));
+        return false;
+    }
+
+    ctx.row_lines.resize(BLOCK_SIZE);
+    ctx.row_lines[rows.count] = ctx.line;
+    rows.count++;
+    if (rows.count == BLOCK_SIZE)
+    {
+        return flush_rows(ctx);
+    }
+    return true;
+}
+
+static bool same_shape(const arena_vector<token> & a, const arena_vector<token> & b)
+/*! Whether two token streams differ at most in their literals' values */
+{
+    if (a.size() != b.size())
+    {
+        return false;
+    }
+    for (size_t index = 0; index < a.size(); index++)
+    {
+        if (a[index].kind != b[index].kind || a[index].position != b[index].position ||
+            a[index].end != b[index].end ||
+            (a[index].kind == OPERATOR_TOKEN && a[index].op != b[index].op))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static status_t rebind_program(program & prog, const arena_vector<token> & tokens,
+                               encoding_t mode, const char *& cursor)
+/*! Retarget prog at mode, taking its literals from tokens, which have
+    the same shape as the ones it was compiled from. Immediates are in
+    token order, and operators the mode can't apply fail as they would
+    when compiling, with cursor moved to the operator */
+{
+    for (size_t pc = 0; pc < prog.code.size(); pc++)
+    {
+        if (prog.code[pc].opcode == OPERATOR &&
+            !is_supported((operator_t)prog.code[pc].operand, mode))
+        {
+            cursor += prog.positions[pc];
+            return PARSE_ERROR;
+        }
+    }
+    prog.mode = mode;
+    size_t immediate = 0;
+    for (const token & tok : tokens)
+    {
+        if (tok.kind == VALUE_TOKEN)
+        {
+            prog.immediates[immediate++] = tok.value;
+        }
+    }
+    return NO_ERROR;
+}
+
+static bool handle_encodings(const char * input, const char * end, context & ctx)
+/*! Evaluate one line in each of ctx.modes, printing a row for each.
+    Literals are read per encoding, but the line is only compiled again
+    where that changes its shape, e.g. where a literal is out of range */
+{
+    reset_arena(ctx.pool);
+    program base(ctx.pool);
+    program prog(ctx.pool);
+    bool based = false;
+    bool all_success = true;
+    uint64_t start = start_timer(ctx);
+    for (encoding_t mode : *ctx.modes)
+    {
+        const char * cursor = input;
+        program * current = &prog;
+        size_t pc = 0;
+        status_t status;
+        tokenize(input, end, mode, false, prog.tokens);
+        if (based && same_shape(base.tokens, prog.tokens))
+        {
+            current = &base;
+            status = rebind_program(base, prog.tokens, mode, cursor);
+        }
+        else
+        {
+            status = compile_tokens(cursor, end, mode, prog);
+            if (status == NO_ERROR && !based)
+            {
+                /* The first to compile is reused from then on */
+                std::swap(base, prog);
+                current = &base;
+                based = true;
+            }
+        }
+        start = charge(ctx, PARSE_PHASE, start);
+        if (status != NO_ERROR)
+        {
+            report_error(ctx, input, cursor, status, encoding_names[mode]);
+            all_success = false;
+            continue;
+        }
+        stack_slot * stack = (stack_slot *)arena_alloc(ctx.pool,
+                                                       stack_slots(*current) * sizeof(stack_slot),
+                                                       alignof(stack_slot));
+        encoded_value result;
+        status = evaluate_program(*current, NULL, stack, result, pc, tracer(ctx));
+        emit_trace(ctx, ctx.line);
+        if (status != NO_ERROR)
+        {
+            count_operators(ctx.counters, *current, pc + 1, 1);
+            report_error(ctx, input, input + current->positions[pc], status,
+                         encoding_names[mode]);
+            start = charge(ctx, EVALUATE_PHASE, start);
+            all_success = false;
+            continue;
+        }
+        count_operators(ctx.counters, *current, current->code.size(), 1);
+        start = charge(ctx, EVALUATE_PHASE, start);
+        ctx.out.text += encoding_names[mode];
+        ctx.out.text += ": ";
+        print_result(ctx, result);
+        start = charge(ctx, FORMAT_PHASE, start);
+    }
+    return all_success;
+}
+
+static bool handle_input(const char * input, size_t size, context & ctx)
+/*! Evaluate one line, which needn't be NUL-terminated: an expression,
+    or a row of values in row mode */
+{
+    const char * end = input + size;
+    ctx.line++;
+    if (ctx.counters)
+    {
+        ctx.counters->lines++;
+    }
+    if (ctx.columns && !ctx.columns->bound)
+    {
+        handle_header(input, end, ctx);
+        return true;
+    }
+    if (ctx.columns)
+    {
+        return handle_table_row(input, end, ctx);
+    }
+    if (ctx.rows)
+    {
+        return handle_row(input, end, ctx);
+    }
+    if (ctx.modes)
+    {
+        return handle_encodings(input, end, ctx);
+    }
+
+    const char * cursor = input;
+    reset_arena(ctx.pool);
+    program prog(ctx.pool);
+    size_t pc = 0;
+    uint64_t start = start_timer(ctx);
+    tokenize(input, end, ctx.mode, false, prog.tokens);
+    size_t output_start = ctx.out.text.size();
+    if (ctx.cache)
+    {
+        cache_key(ctx.cache->key, ctx.mode, prog.tokens);
+        const std::string * output = cache_lookup(*ctx.cache, ctx.cache->key);
+        if (output)
+        {
+            ctx.out.text += *output;
+            if (ctx.counters)
+            {
+                ctx.counters->results++;
+            }
+            charge(ctx, PARSE_PHASE, start);
+            return true;
+        }
+    }
+    status_t status = compile_tokens(cursor, end, ctx.mode, prog);
+    start = charge(ctx, PARSE_PHASE, start);
+    if (status != NO_ERROR)
+    {
+        report_error(ctx, input, cursor, status);
+        return false;
+    }
+    stack_slot * stack = (stack_slot *)arena_alloc(ctx.pool,
+                                                   stack_slots(prog) * sizeof(stack_slot),
+                                                   alignof(stack_slot));
+    encoded_value result;
+    status = evaluate_program(prog, NULL, stack, result, pc, tracer(ctx));
+    emit_trace(ctx, ctx.line);
+    if (status != NO_ERROR)
+    {
+        count_operators(ctx.counters, prog, pc + 1, 1);
+        report_error(ctx, input, input + prog.positions[pc], status);
+        charge(ctx, EVALUATE_PHASE, start);
+        return false;
+    }
+    count_operators(ctx.counters, prog, prog.code.size(), 1);
+    start = charge(ctx, EVALUATE_PHASE, start);
+    print_result(ctx, result);
+    charge(ctx, FORMAT_PHASE, start);
+    if (ctx.cache)
+    {
+        cache_insert(*ctx.cache, ctx.cache->key, ctx.out.text.data() + output_start,
+                     ctx.out.text.size() - output_start);
+    }
+    return true;
 }
 
 void usage(char * me)
 {
-    fprintf(stderr, "Usage: %s [-v] mode\n"
+    fprintf(stderr, "Usage: %s [-v] [-s] [-b] [-r] [-f file] [-j threads] [-c entries]\n"
+                    "       [--trace=file] [--stats[=json]] [--history=entries]\n"
+                    "       [--history-file=file] [--csv[=name] | --tsv[=name]]\n"
+                    "       [-e expression [-w range [-m expression]]] mode\n"
+                    "       %s [-s] [-j threads] [-S socket] [-T [host:]port] [mode]\n"
+                    "       %s [-s] --read-trace=file\n"
                     "-v: Be verbose, print each computation step\n"
+                    "-s: Print floating-point values with the fewest digits that\n"
+                    "    read back to the same bits, rather than with %%f\n"
+                    "-b: Batch mode, read expressions from stdin without line editing\n"
+                    "    (the default when stdin is not a terminal)\n"
+                    "-f: Batch mode, reading expressions from file instead of stdin\n"
+                    "-r: With -e, read rows as packed little-endian values of the mode,\n"
+                    "    one per variable, and write each result the same way\n"
+                    "-j: Evaluate batch input on this many threads, keeping output in order\n"
+                    "-c: Cache the results of up to this many distinct expressions (per\n"
+                    "    thread), and print the cache's hit and miss counts on exit\n"
+                    "    (not with --trace, which records every line's steps)\n"
+                    "-e: Compile expression once, then evaluate it for each input row;\n"
+                    "    a row holds whitespace or comma separated values for the\n"
+                    "    expression's variables, in order of first appearance\n"
+                    "-w: Instead of reading rows, evaluate the -e expression for every\n"
+                    "    value of its variable in range, first:last or all, and print\n"
+                    "    the minimum and maximum results. Integer modes of up to 64 bits\n"
+                    "    only, and on every core unless -j is given (not with -v or\n"
+                    "    --trace)\n"
+                    "--trace=file: Record each computation step in file, to be shown\n"
+                    "    later with --read-trace=file\n"
+                    "--stats[=json]: On exit, print line, result, error and operator\n"
+                    "    counts and the time spent parsing, evaluating, formatting and\n"
+                    "    on I/O (summed over threads), to stderr (not with -w, -S or -T)\n"
+                    "--history=entries: Keep at most this many lines of interactive\n"
+                    "    history, not counting repeats of the line before (default 1000)\n"
+                    "--history-file=file: Load the history from file when the first\n"
+                    "    prompt is shown, and add this session's lines to it on exit\n"
+                    "--csv[=name], --tsv[=name]: With -e, read comma or tab separated\n"
+                    "    rows under a header row, binding each variable to the field it\n"
+                    "    names, and write each row back with the result added as a\n"
+                    "    field called name (default result)\n"
+                    "-m: With -w, also count the values for which this second expression\n"
+                    "    gives the same result, and print the first that doesn't\n"
+                    "-S: Serve requests on a Unix socket: each line is \"[mode] expression\",\n"
+                    "    answered by a line \"dec (hex)\" or \"error: message at offset\".\n"
+                    "    mode is the default for requests that don't name one\n"
+                    "-T: Serve requests over TCP, on localhost unless host is given\n"
                     "mode: one of the following:\n"
-                    "  s8,s16,s32,s64: Use 8,16,32,64 bit signed encoding\n"
-                    "  u8,u16,u32,u64: Use 8,16,32,64 bit unsigned encoding\n"
-                    "  f32,f64: Use 32 or 64 bit floating-point encoding\n", me);
+                    "  s8,s16,s32,s64,s128: Use 8,16,32,64,128 bit signed encoding\n"
+                    "  u8,u16,u32,u64,u128: Use 8,16,32,64,128 bit unsigned encoding\n"
+                    "  f32,f64: Use 32 or 64 bit floating-point encoding\n"
+                    "  s8x16,s16x8,s32x4,s64x2,u8x16,u16x8,u32x4,u64x2,f32x4,f64x2:\n"
+                    "    Use a 128 bit register of lanes, as in SSE and NEON. Each operator\n"
+                    "    applies lane by lane; a literal is {lane 0, lane 1, ...}, one\n"
+                    "    value to put in every lane, or x and up to 32 hex digits for the\n"
+                    "    whole register, lane 0 in its low bits\n"
+                    "  or a comma separated list of them, or all, to print a row for\n"
+                    "  each encoding (not with -e)\n", me, me, me);
+}
+
+struct worker_pool
+/*! Threads that each run task(index) once per call to run_pool */
+{
+    std::vector<std::thread> threads;
+    std::mutex lock;
+    std::condition_variable wake;
+    std::condition_variable done;
+    std::function<void(int)> task;
+    unsigned generation;
+    int pending;
+    bool stopping;
+};
+
+static void pool_worker(worker_pool & pool, int index)
+{
+    unsigned generation = 0;
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> guard(pool.lock);
+            pool.wake.wait(guard, [&] { return pool.stopping || pool.generation != generation; });
+            if (pool.stopping)
+            {
+                return;
+            }
+            generation = pool.generation;
+        }
+        pool.task(index);
+        std::lock_guard<std::mutex> guard(pool.lock);
+        if (--pool.pending == 0)
+        {
+            pool.done.notify_one();
+        }
+    }
+}
+
+static void start_pool(worker_pool & pool, int size)
+{
+    pool.generation = 0;
+    pool.pending = 0;
+    pool.stopping = false;
+    for (int index = 0; index < size; index++)
+    {
+        pool.threads.push_back(std::thread(pool_worker, std::ref(pool), index));
+    }
+}
+
+static void run_pool(worker_pool & pool, const std::function<void(int)> & task)
+/*! Returns once every thread has finished the task */
+{
+    std::unique_lock<std::mutex> guard(pool.lock);
+    pool.task = task;
+    pool.pending = pool.threads.size();
+    pool.generation++;
+    pool.wake.notify_all();
+    pool.done.wait(guard, [&] { return pool.pending == 0; });
+}
+
+static void stop_pool(worker_pool & pool)
+{
+    {
+        std::lock_guard<std::mutex> guard(pool.lock);
+        pool.stopping = true;
+    }
+    pool.wake.notify_all();
+    for (size_t index = 0; index < pool.threads.size(); index++)
+    {
+        pool.threads[index].join();
+    }
+    pool.threads.clear();
+}
+
+static bool is_exit(const char * input, size_t size)
+{
+    return size == 4 && memcmp(input, "exit", 4) == 0;
+}
+
+static void handle_lines(context & ctx, const line_span * lines, size_t count)
+{
+    for (size_t index = 0; index < count; index++)
+    {
+        if (lines[index].size != 0)
+        {
+            handle_input(lines[index].text, lines[index].size, ctx);
+        }
+        else
+        {
+            ctx.line++;
+        }
+    }
+}
+
+template <typename type, int capacity>
+struct spsc_queue
+/*! A ring between one producer thread and one consumer. Each side only
+    stores its own index, so neither takes a lock; the semaphores count
+    items and free slots, and put a side to sleep only when the ring is
+    empty or full */
+{
+    type slots[capacity];
+    std::atomic<size_t> head; /* Next slot to pop */
+    std::atomic<size_t> tail; /* Next slot to push */
+    sem_t items;
+    sem_t spaces;
+};
+
+template <typename type, int capacity>
+static void init_queue(spsc_queue<type, capacity> & queue)
+{
+    queue.head.store(0);
+    queue.tail.store(0);
+    sem_init(&queue.items, 0, 0);
+    sem_init(&queue.spaces, 0, capacity);
+}
+
+template <typename type, int capacity>
+static void destroy_queue(spsc_queue<type, capacity> & queue)
+{
+    sem_destroy(&queue.items);
+    sem_destroy(&queue.spaces);
+}
+
+static void wait_semaphore(sem_t & semaphore)
+{
+    while (sem_wait(&semaphore) < 0 && errno == EINTR)
+    {
+    }
+}
+
+template <typename type, int capacity>
+static void push(spsc_queue<type, capacity> & queue, type value)
+{
+    wait_semaphore(queue.spaces);
+    size_t tail = queue.tail.load(std::memory_order_relaxed);
+    queue.slots[tail % capacity] = value;
+    queue.tail.store(tail + 1, std::memory_order_release);
+    sem_post(&queue.items);
+}
+
+template <typename type, int capacity>
+static type pop(spsc_queue<type, capacity> & queue)
+{
+    wait_semaphore(queue.items);
+    size_t head = queue.head.load(std::memory_order_relaxed);
+    type value = queue.slots[head % capacity];
+    queue.head.store(head + 1, std::memory_order_release);
+    sem_post(&queue.spaces);
+    return value;
+}
+
+template <typename type, int capacity>
+static bool try_pop(spsc_queue<type, capacity> & queue, type & value)
+{
+    if (sem_trywait(&queue.items) < 0)
+    {
+        return false;
+    }
+    size_t head = queue.head.load(std::memory_order_relaxed);
+    value = queue.slots[head % capacity];
+    queue.head.store(head + 1, std::memory_order_release);
+    sem_post(&queue.spaces);
+    return true;
+}
+
+struct read_buffer
+{
+    char * data;
+    size_t capacity;
+    size_t size;  /* Whole lines, unless final */
+    bool final;   /* The end of the input */
+};
+
+struct output_chunk
+/*! A context's output, handed from the evaluator to the writer */
+{
+    std::string out;
+    std::string err;
+    std::vector<error_mark> err_marks;
+    std::string trace_records;
+};
+
+enum
+{
+    READ_BUFFERS = 2,                 /* One being read while the other is evaluated */
+    OUTPUT_CHUNKS = 16,
+    OUTPUT_COALESCE_BYTES = 1 << 20,  /* Most a writer gathers into one write */
+};
+
+struct pipeline
+/*! Batch input from a descriptor in three stages: a reader thread fills
+    one buffer while the evaluator works through the lines in the other,
+    and a writer thread gathers the output into large writes. The stages
+    hand buffers and chunks round through queues, so none is allocated
+    per block once they have grown */
+{
+    int fd;
+    FILE * trace_file;
+    read_buffer buffers[READ_BUFFERS];
+    spsc_queue<read_buffer *, READ_BUFFERS> filled;
+    spsc_queue<read_buffer *, READ_BUFFERS> emptied;
+    output_chunk chunks[OUTPUT_CHUNKS];
+    spsc_queue<output_chunk *, OUTPUT_CHUNKS + 1> unwritten; /* And NULL at the end */
+    spsc_queue<output_chunk *, OUTPUT_CHUNKS> written;
+    std::atomic<bool> stopping;
+    int stop_pipe[2];  /* Wakes a reader waiting for input that won't be needed */
+    stats * reader_stats; /* Or NULL */
+    stats * writer_stats;
+};
+
+struct batch
+/*! Evaluation state shared by the stdin and mapped file readers. With
+    more than one job, each block's lines are split into one chunk per
+    thread, and the chunks' output is written back in order */
+{
+    context * ctx;
+    pipeline * stages; /* Or NULL to write output directly */
+    int jobs;
+    size_t block_size;
+    worker_pool pool;
+    std::vector<context> workers;
+    std::vector<row_block> worker_rows;
+    std::vector<result_cache> worker_caches;
+    std::vector<stats> worker_stats;
+    std::vector<line_span> lines;
+};
+
+static void send_output(batch & b, context & ctx)
+/*! Write out what ctx has collected, or hand it to the writer stage */
+{
+    if (!b.stages)
+    {
+        write_output(ctx);
+        return;
+    }
+    if (ctx.out.text.empty() && ctx.err.empty() && ctx.trace_records.empty())
+    {
+        return;
+    }
+    output_chunk * chunk = pop(b.stages->written);
+    chunk->out.swap(ctx.out.text);
+    chunk->err.swap(ctx.err);
+    chunk->err_marks.swap(ctx.err_marks);
+    chunk->trace_records.swap(ctx.trace_records);
+    push(b.stages->unwritten, chunk);
+}
+
+static void buffer_stdout()
+{
+    static char output_buf[1 << 20];
+    if (!isatty(STDOUT_FILENO))
+    {
+        setvbuf(stdout, output_buf, _IOFBF, sizeof output_buf);
+    }
+}
+
+static void start_batch(batch & b, context & ctx, int jobs)
+{
+    buffer_stdout();
+
+    b.ctx = &ctx;
+    b.stages = NULL;
+    b.jobs = jobs;
+    b.block_size = max(1 << 20, jobs << 18);
+    if (jobs > 1)
+    {
+        b.worker_rows.resize(jobs);
+        b.worker_caches.resize(jobs);
+        b.worker_stats.resize(jobs);
+        for (int index = 0; index < jobs; index++)
+        {
+            context worker = {ctx.mode, ctx.verbose, NULL, NULL, ctx.modes, NULL, ctx.trace_file};
+            worker.out.float_format = ctx.out.float_format;
+            if (ctx.cache)
+            {
+                b.worker_caches[index].capacity = ctx.cache->capacity;
+                worker.cache = &b.worker_caches[index];
+            }
+            if (ctx.counters)
+            {
+                worker.counters = &b.worker_stats[index];
+            }
+            if (ctx.rows)
+            {
+                init_row_block(b.worker_rows[index], *ctx.rows->prog);
+                worker.rows = &b.worker_rows[index];
+            }
+            worker.columns = ctx.columns;
+            b.workers.push_back(worker);
+        }
+        start_pool(b.pool, jobs);
+    }
+}
+
+static bool split_lines(batch & b, const char * begin, const char * end, bool final,
+                        const char *& rest)
+/*! Collect the complete lines from begin to end, and if final the last
+    unterminated one too; rest is left where the next line starts.
+    Returns false if an "exit" line ends the input */
+{
+    b.lines.clear();
+    const char * line = begin;
+    const char * newline;
+    while ((newline = (const char *)memchr(line, '\n', end - line)))
+    {
+        if (is_exit(line, newline - line))
+        {
+            rest = end;
+            return false;
+        }
+        line_span span = {line, (size_t)(newline - line)};
+        b.lines.push_back(span);
+        line = newline + 1;
+    }
+    if (final && line < end)
+    {
+        if (is_exit(line, end - line))
+        {
+            rest = end;
+            return false;
+        }
+        line_span span = {line, (size_t)(end - line)};
+        b.lines.push_back(span);
+        line = end;
+    }
+    rest = line;
+    return true;
+}
+
+static void evaluate_lines(batch & b)
+{
+    size_t first = 0;
+    if (b.ctx->columns && b.jobs > 1)
+    {
+        /* Every worker binds its rows by the header, so it is read first */
+        while (!b.ctx->columns->bound && first < b.lines.size())
+        {
+            handle_lines(*b.ctx, &b.lines[first++], 1);
+        }
+        send_output(b, *b.ctx);
+    }
+    if (b.jobs > 1)
+    {
+        size_t count = b.lines.size() - first;
+        run_pool(b.pool, [&](int index)
+        {
+            size_t begin = first + count * index / b.jobs;
+            size_t end = first + count * (index + 1) / b.jobs;
+            b.workers[index].line = b.ctx->line + begin - first;
+            handle_lines(b.workers[index], &b.lines[begin], end - begin);
+            if (b.workers[index].rows)
+            {
+                flush_rows(b.workers[index]);
+            }
+        });
+        for (int index = 0; index < b.jobs; index++)
+        {
+            send_output(b, b.workers[index]);
+        }
+        b.ctx->line += count;
+    }
+    else
+    {
+        handle_lines(*b.ctx, b.lines.data(), b.lines.size());
+        if (b.ctx->columns)
+        {
+            /* Pending rows are written as they were read, and the block
+               they are in is about to be reused */
+            flush_rows(*b.ctx);
+        }
+        send_output(b, *b.ctx);
+    }
+}
+
+static void finish_batch(batch & b)
+{
+    if (b.jobs > 1)
+    {
+        stop_pool(b.pool);
+        for (int index = 0; index < b.jobs; index++)
+        {
+            free_row_block(b.worker_rows[index]);
+            free_arena(b.workers[index].pool);
+            if (b.ctx->cache)
+            {
+                b.ctx->cache->hits += b.worker_caches[index].hits;
+                b.ctx->cache->misses += b.worker_caches[index].misses;
+            }
+            if (b.ctx->counters)
+            {
+                add_stats(*b.ctx->counters, b.worker_stats[index]);
+            }
+        }
+    }
+    else if (b.ctx->rows)
+    {
+        flush_rows(*b.ctx);
+        send_output(b, *b.ctx);
+    }
+}
+
+static bool grow_buffer(read_buffer & buffer, size_t capacity)
+{
+    if (buffer.capacity >= capacity)
+    {
+        return true;
+    }
+    char * data = (char *)realloc(buffer.data, capacity);
+    if (!data)
+    {
+        perror("realloc");
+        return false;
+    }
+    buffer.data = data;
+    buffer.capacity = capacity;
+    return true;
+}
+
+static void hand_over(pipeline & p, read_buffer * buffer, size_t lines, read_buffer * next)
+/*! Send the whole lines in buffer to the evaluator, and start next with
+    the partial line after them */
+{
+    size_t rest = buffer->size - lines;
+    if (!grow_buffer(*next, max(next->capacity, 2 * rest)))
+    {
+        rest = 0;
+    }
+    memcpy(next->data, buffer->data + lines, rest);
+    next->size = rest;
+    next->final = false;
+    buffer->size = lines;
+    buffer->final = false;
+    push(p.filled, buffer);
+}
+
+static void read_stage(pipeline & p)
+/*! Keep reading while the evaluator is busy, and hand it everything up
+    to the last newline as soon as it is free. It returns each buffer
+    with a byte on stop_pipe, so a reader waiting for input wakes up to
+    pass on what it has */
+{
+    read_buffer * buffer = pop(p.emptied);
+    buffer->size = 0;
+    size_t lines = 0; /* Bytes of whole lines in buffer */
+    pollfd fds[2] = {{p.fd, POLLIN}, {p.stop_pipe[0], POLLIN}};
+    while (!p.stopping.load())
+    {
+        read_buffer * next;
+        if (lines > 0 && try_pop(p.emptied, next))
+        {
+            hand_over(p, buffer, lines, next);
+            buffer = next;
+            lines = 0;
+            continue;
+        }
+        if (buffer->size == buffer->capacity)
+        {
+            if (lines > 0)
+            {
+                next = pop(p.emptied);
+                hand_over(p, buffer, lines, next);
+                buffer = next;
+                lines = 0;
+                continue;
+            }
+            /* A single line fills the whole buffer */
+            if (!grow_buffer(*buffer, 2 * buffer->capacity))
+            {
+                break;
+            }
+        }
+        if (poll(fds, 2, -1) < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            perror("poll");
+            break;
+        }
+        if (fds[1].revents)
+        {
+            char wakes[64];
+            while (read(p.stop_pipe[0], wakes, sizeof wakes) > 0)
+            {
+            }
+            continue;
+        }
+        uint64_t start = p.reader_stats ? read_cycles() : 0;
+        ssize_t count = read(p.fd, buffer->data + buffer->size, buffer->capacity - buffer->size);
+        if (p.reader_stats)
+        {
+            p.reader_stats->cycles[IO_PHASE] += read_cycles() - start;
+        }
+        if (count < 0)
+        {
+            if (errno == EINTR || errno == EAGAIN)
+            {
+                continue;
+            }
+            perror("read");
+            break;
+        }
+        if (count == 0)
+        {
+            break;
+        }
+        const char * newline = (const char *)memrchr(buffer->data + buffer->size, '\n', count);
+        buffer->size += count;
+        if (newline)
+        {
+            lines = newline + 1 - buffer->data;
+        }
+    }
+    buffer->final = true;
+    push(p.filled, buffer);
+}
+
+static void write_iovecs(iovec * chunks, int count)
+/*! Write them all to stdout, however many calls it takes */
+{
+    while (count > 0)
+    {
+        ssize_t written = writev(STDOUT_FILENO, chunks, count);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return;
+        }
+        while (count > 0 && (size_t)written >= chunks->iov_len)
+        {
+            written -= chunks->iov_len;
+            chunks++;
+            count--;
+        }
+        if (count > 0)
+        {
+            chunks->iov_base = (char *)chunks->iov_base + written;
+            chunks->iov_len -= written;
+        }
+    }
+}
+
+static void write_messages(const output_chunk & chunk)
+/*! The rest of a chunk whose output has been written up to its first
+    message: each run of messages, then the output up to the next */
+{
+    const std::vector<error_mark> & marks = chunk.err_marks;
+    for (size_t index = 0; index < marks.size(); index++)
+    {
+        bool last = index + 1 == marks.size();
+        size_t err_end = last ? chunk.err.size() : marks[index + 1].err;
+        size_t out_end = last ? chunk.out.size() : marks[index + 1].out;
+        fwrite(chunk.err.data() + marks[index].err, 1, err_end - marks[index].err, stderr);
+        iovec rest = {(void *)(chunk.out.data() + marks[index].out), out_end - marks[index].out};
+        write_iovecs(&rest, 1);
+    }
+}
+
+static void write_stage(pipeline & p)
+/*! Gather whatever output is waiting, up to OUTPUT_COALESCE_BYTES, into
+    one writev. A chunk with errors ends a gathering, and only its output
+    before the first message goes in the writev, so that each message
+    still follows the output before it */
+{
+    output_chunk * gathered[OUTPUT_CHUNKS];
+    iovec chunks[OUTPUT_CHUNKS];
+    bool done = false;
+    while (!done)
+    {
+        int count = 0;
+        size_t bytes = 0;
+        output_chunk * chunk = pop(p.unwritten);
+        while (chunk)
+        {
+            chunks[count].iov_base = (void *)chunk->out.data();
+            chunks[count].iov_len = chunk->err_marks.empty() ? chunk->out.size()
+                                                             : chunk->err_marks[0].out;
+            gathered[count++] = chunk;
+            bytes += chunk->out.size();
+            if (!chunk->err.empty() || count == OUTPUT_CHUNKS || bytes >= OUTPUT_COALESCE_BYTES ||
+                !try_pop(p.unwritten, chunk))
+            {
+                break;
+            }
+        }
+        done = !chunk;
+
+        uint64_t start = p.writer_stats ? read_cycles() : 0;
+        write_iovecs(chunks, count);
+        for (int index = 0; index < count; index++)
+        {
+            chunk = gathered[index];
+            write_messages(*chunk);
+            if (!chunk->trace_records.empty())
+            {
+                fwrite(chunk->trace_records.data(), 1, chunk->trace_records.size(), p.trace_file);
+            }
+            chunk->out.clear();
+            chunk->err.clear();
+            chunk->err_marks.clear();
+            chunk->trace_records.clear();
+            push(p.written, chunk);
+        }
+        if (p.writer_stats)
+        {
+            p.writer_stats->cycles[IO_PHASE] += read_cycles() - start;
+        }
+    }
+}
+
+static void run_batch(context & ctx, int jobs, int fd)
+/*! Read fd in large blocks and split lines in place, so there is
+    no per-line allocation, prompt or history. Reading, evaluating and
+    writing each have a thread, so a slow producer or consumer at
+    either end of a shell pipeline doesn't hold up the others */
+{
+    pipeline p;
+    stats io_stats[2] = {};
+    p.fd = fd;
+    p.trace_file = ctx.trace_file;
+    p.reader_stats = ctx.counters ? &io_stats[0] : NULL;
+    p.writer_stats = ctx.counters ? &io_stats[1] : NULL;
+    p.stopping.store(false);
+    if (pipe2(p.stop_pipe, O_NONBLOCK | O_CLOEXEC) < 0)
+    {
+        perror("pipe");
+        return;
+    }
+    init_queue(p.filled);
+    init_queue(p.emptied);
+    init_queue(p.unwritten);
+    init_queue(p.written);
+
+    batch b;
+    start_batch(b, ctx, jobs);
+    b.stages = &p;
+    bool allocated = true;
+    for (int index = 0; index < READ_BUFFERS; index++)
+    {
+        p.buffers[index] = {(char *)malloc(b.block_size), b.block_size, 0, false};
+        allocated = allocated && p.buffers[index].data;
+        push(p.emptied, &p.buffers[index]);
+    }
+    for (int index = 0; index < OUTPUT_CHUNKS; index++)
+    {
+        push(p.written, &p.chunks[index]);
+    }
+    if (!allocated)
+    {
+        perror("malloc");
+    }
+    else
+    {
+        fflush(stdout);
+        std::thread reader(read_stage, std::ref(p));
+        std::thread writer(write_stage, std::ref(p));
+        while (true)
+        {
+            read_buffer * buffer = pop(p.filled);
+            const char * rest;
+            bool done = !split_lines(b, buffer->data, buffer->data + buffer->size, buffer->final,
+                                     rest) || buffer->final;
+            evaluate_lines(b);
+            if (done)
+            {
+                p.stopping.store(true);
+            }
+            push(p.emptied, buffer);
+            if (write(p.stop_pipe[1], "", 1) < 0)
+            {
+                /* Full, so the reader has wakes waiting already */
+            }
+            if (done)
+            {
+                break;
+            }
+        }
+        finish_batch(b);
+        push(p.unwritten, (output_chunk *)NULL);
+        writer.join();
+        reader.join();
+    }
+
+    for (int index = 0; index < READ_BUFFERS; index++)
+    {
+        free(p.buffers[index].data);
+    }
+    destroy_queue(p.filled);
+    destroy_queue(p.emptied);
+    destroy_queue(p.unwritten);
+    destroy_queue(p.written);
+    close(p.stop_pipe[0]);
+    close(p.stop_pipe[1]);
+    if (ctx.counters)
+    {
+        add_stats(*ctx.counters, io_stats[0]);
+        add_stats(*ctx.counters, io_stats[1]);
+    }
+}
+
+static bool map_input(const char * path, const char *& map, size_t & size, int & fd)
+/*! Map path read-only for sequential access. Pipes and devices can't
+    be mapped, so they are left open as fd instead, with map NULL.
+    Returns false, having said why, if path can't be opened */
+{
+    map = NULL;
+    size = 0;
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        perror(path);
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) < 0)
+    {
+        perror(path);
+        close(fd);
+        return false;
+    }
+    if (!S_ISREG(info.st_mode))
+    {
+        return true;
+    }
+    size = info.st_size;
+    if (size > 0)
+    {
+        map = (const char *)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED)
+        {
+            perror(path);
+            close(fd);
+            return false;
+        }
+        madvise((void *)map, size, MADV_SEQUENTIAL);
+    }
+    close(fd);
+    fd = -1;
+    return true;
+}
+
+static void release_input(const char * map, const char * done)
+/*! Drop the pages of a sequential mapping up to done */
+{
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    madvise((void *)map, (done - map) / page_size * page_size, MADV_DONTNEED);
+}
+
+static bool run_mapped(context & ctx, int jobs, const char * path)
+/*! Evaluate lines straight out of a read-only mapping of the file,
+    a block at a time. Pages already evaluated are dropped again, so
+    resident memory stays around one block however big the file is */
+{
+    const char * map;
+    size_t size;
+    int fd;
+    if (!map_input(path, map, size, fd))
+    {
+        return false;
+    }
+    if (fd >= 0)
+    {
+        run_batch(ctx, jobs, fd);
+        close(fd);
+        return true;
+    }
+
+    batch b;
+    start_batch(b, ctx, jobs);
+    const char * map_end = map + size;
+    const char * block = map;
+    while (block < map_end)
+    {
+        const char * block_end = block + std::min<size_t>(b.block_size, map_end - block);
+        const char * newline = (const char *)memchr(block_end, '\n', map_end - block_end);
+        block_end = newline ? newline + 1 : map_end;
+
+        const char * rest;
+        bool more = split_lines(b, block, block_end, block_end == map_end, rest);
+        evaluate_lines(b);
+        if (!more)
+        {
+            break;
+        }
+        release_input(map, block_end);
+        block = block_end;
+    }
+    finish_batch(b);
+    if (map)
+    {
+        munmap((void *)map, size);
+    }
+    return true;
+}
+
+template <typename type>
+static void gather_columns(const program & prog, const char * input, int count, char * columns)
+{
+    size_t variables = prog.variables.size();
+    const type * rows = (const type *)input;
+    for (size_t index = 0; index < variables; index++)
+    {
+        type * column = (type *)(columns + index * BLOCK_SIZE * LANE_BYTES);
+        for (int row = 0; row < count; row++)
+        {
+            memcpy(&column[row], &rows[row * variables + index], sizeof(type));
+        }
+    }
+}
+
+static void evaluate_raw(context & ctx, const char * input, size_t count)
+/*! Evaluate count packed rows, appending each packed result to the
+    output. A full block of a single variable is already a column, so
+    it is evaluated where it lies */
+{
+    row_block & rows = *ctx.rows;
+    const program & prog = *rows.prog;
+    int size = encoding_sizes[prog.mode];
+    size_t row_size = prog.variables.size() * size;
+    size_t failures = 0;
+    uint64_t start = start_timer(ctx);
+    for (size_t row = 0; row < count; row += BLOCK_SIZE)
+    {
+        int block = std::min<size_t>(BLOCK_SIZE, count - row);
+        const char * data = input + row * row_size;
+        const char * columns = rows.columns;
+        if (prog.variables.size() == 1 && block == BLOCK_SIZE)
+        {
+            columns = data;
+        }
+        else
+        {
+            switch (size)
+            {
+            case 1:
+                gather_columns<uint8_t>(prog, data, block, rows.columns);
+                break;
+            case 2:
+                gather_columns<uint16_t>(prog, data, block, rows.columns);
+                break;
+            case 4:
+                gather_columns<uint32_t>(prog, data, block, rows.columns);
+                break;
+            case 8:
+                gather_columns<uint64_t>(prog, data, block, rows.columns);
+                break;
+            default:
+                gather_columns<uint128_t>(prog, data, block, rows.columns);
+                break;
+            }
+        }
+        start = charge(ctx, PARSE_PHASE, start);
+        size_t pc;
+        evaluate_rows(prog, columns, rows.stack, block, pc, rows.trapped);
+        count_operators(ctx.counters, prog, prog.code.size(), block);
+        start = charge(ctx, EVALUATE_PHASE, start);
+        for (int index = 0; index < block; index++)
+        {
+            /* Written as 0, so the rows after it stay in place */
+            if (rows.trapped[index])
+            {
+                report_trapped_row(ctx, rows, columns, index, NULL);
+                memset(rows.stack + index * size, 0, size);
+                failures++;
+            }
+        }
+        ctx.out.text.append(rows.stack, block * size);
+        start = charge(ctx, FORMAT_PHASE, start);
+    }
+    if (ctx.counters)
+    {
+        ctx.counters->results += count - failures;
+    }
+}
+
+static bool run_raw(context & ctx, int fd)
+/*! Row mode with packed little-endian values of the mode for both the
+    rows read from fd, each variable in turn, and the results written */
+{
+    buffer_stdout();
+    const program & prog = *ctx.rows->prog;
+    size_t row_size = prog.variables.size() * encoding_sizes[prog.mode];
+    size_t capacity = (1 << 20) / row_size * row_size;
+    std::vector<char> buffer(capacity);
+    size_t used = 0;
+    while (true)
+    {
+        uint64_t start = start_timer(ctx);
+        ssize_t count = read(fd, &buffer[used], capacity - used);
+        charge(ctx, IO_PHASE, start);
+        if (count < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            perror("read");
+            return false;
+        }
+        if (count == 0)
+        {
+            break;
+        }
+        used += count;
+        size_t rows = used / row_size;
+        evaluate_raw(ctx, buffer.data(), rows);
+        write_output(ctx);
+        memmove(buffer.data(), &buffer[rows * row_size], used - rows * row_size);
+        used -= rows * row_size;
+    }
+    if (used != 0)
+    {
+        fprintf(stderr, "Input ends partway through a row\n");
+        return false;
+    }
+    return true;
+}
+
+static bool run_raw_mapped(context & ctx, const char * path)
+/*! run_raw on a mapped file, a block at a time */
+{
+    const char * map;
+    size_t size;
+    int fd;
+    if (!map_input(path, map, size, fd))
+    {
+        return false;
+    }
+    if (fd >= 0)
+    {
+        bool success = run_raw(ctx, fd);
+        close(fd);
+        return success;
+    }
+
+    buffer_stdout();
+    const program & prog = *ctx.rows->prog;
+    size_t row_size = prog.variables.size() * encoding_sizes[prog.mode];
+    size_t rows = size / row_size;
+    size_t chunk = (1 << 20) / row_size;
+    for (size_t row = 0; row < rows; row += chunk)
+    {
+        const char * data = map + row * row_size;
+        size_t count = std::min(chunk, rows - row);
+        evaluate_raw(ctx, data, count);
+        write_output(ctx);
+        release_input(map, data + count * row_size);
+    }
+    if (map)
+    {
+        munmap((void *)map, size);
+    }
+    if (size % row_size != 0)
+    {
+        fprintf(stderr, "Input ends partway through a row\n");
+        return false;
+    }
+    return true;
+}
+
+struct sweep
+/*! An expression to evaluate for every value of its variable from first
+    to last, and optionally a second expression it should match */
+{
+    const program * prog;
+    const program * check;  /* Or NULL */
+    encoded_value first;
+    unsigned __int128 size; /* Up to 2^64 values */
+};
+
+struct sweep_result
+/*! Offsets are from the start of the whole range */
+{
+    bool any;
+    encoded_value min;
+    encoded_value max;
+    uint64_t min_offset;
+    uint64_t max_offset;
+    uint64_t matches;
+    bool mismatched;
+    uint64_t mismatch_offset;
+    encoded_value mismatch;
+    encoded_value expected;
+    uint64_t traps;         /* Values for which either expression's division traps */
+    uint64_t trap_offset;
+};
+
+template <typename type>
+static KERNEL void fill_block(type * column, uint64_t first, int count)
+{
+    for (int index = 0; index < count; index++)
+    {
+        column[index] = (type)(first + index);
+    }
+}
+
+template <typename type>
+static KERNEL void reduce_block(const type * values, const type * expected, int count,
+                                type & low, type & high, int & matches)
+/*! expected is NULL without a second expression */
+{
+    low = values[0];
+    high = values[0];
+    for (int index = 1; index < count; index++)
+    {
+        low = std::min(low, values[index]);
+        high = std::max(high, values[index]);
+    }
+    matches = 0;
+    if (expected)
+    {
+        for (int index = 0; index < count; index++)
+        {
+            matches += values[index] == expected[index];
+        }
+    }
+}
+
+template <typename type>
+static KERNEL int mask_traps(bool * trapped, const bool * check_trapped, type * values,
+                             type * expected, int count, int & first)
+/*! Give each row where a division trapped the result of one that didn't,
+    and expect that of it, so it counts towards neither the minimum and
+    maximum nor the mismatches; trapped is left flagging the rows where
+    either expression's did. Returns how many, and the first in first;
+    when all of them did, the block is left as it is */
+{
+    int traps = 0;
+    int kept = -1;
+    first = -1;
+    for (int index = 0; index < count; index++)
+    {
+        trapped[index] |= check_trapped && check_trapped[index];
+        if (trapped[index])
+        {
+            if (traps++ == 0)
+            {
+                first = index;
+            }
+        }
+        else if (kept < 0)
+        {
+            kept = index;
+        }
+    }
+    if (traps == 0 || kept < 0)
+    {
+        return traps;
+    }
+    for (int index = 0; index < count; index++)
+    {
+        if (trapped[index])
+        {
+            values[index] = values[kept];
+            if (expected)
+            {
+                expected[index] = values[kept];
+            }
+        }
+    }
+    return traps;
+}
+
+template <typename type>
+static int find_value(const type * values, const bool * trapped, int count, type value)
+/*! The first row with value that didn't trap */
+{
+    int index = 0;
+    while (index < count - 1 && (values[index] != value || trapped[index]))
+    {
+        index++;
+    }
+    return index;
+}
+
+template <typename type>
+static KERNEL void sweep_range(const sweep & job, row_block & rows, row_block & check_rows,
+                               unsigned __int128 begin, unsigned __int128 end,
+                               sweep_result & result)
+/*! Evaluate offsets begin to end of the range a block at a time with
+    the vector kernels, then reduce each block. Full blocks go through
+    the helpers with a constant count, which lets them be vectorized */
+{
+    encoding_t mode = job.prog->mode;
+    uint64_t first = job.first.u64;
+    type * column = (type *)rows.columns;
+    type * check_column = (type *)check_rows.columns;
+    type * values = (type *)rows.stack;
+    type * expected = (type *)check_rows.stack;
+    size_t pc;
+    for (unsigned __int128 block = begin; block < end; block += BLOCK_SIZE)
+    {
+        int count = std::min<unsigned __int128>(BLOCK_SIZE, end - block);
+        uint64_t offset = (uint64_t)block;
+        if (count == BLOCK_SIZE)
+        {
+            fill_block(column, first + offset, BLOCK_SIZE);
+        }
+        else
+        {
+            fill_block(column, first + offset, count);
+        }
+        evaluate_rows(*job.prog, rows.columns, rows.stack, count, pc, rows.trapped);
+        if (job.check)
+        {
+            memcpy(check_column, column, count * sizeof(type));
+            evaluate_rows(*job.check, check_rows.columns, check_rows.stack, count, pc,
+                          check_rows.trapped);
+        }
+        int first_trap;
+        int traps = mask_traps(rows.trapped, job.check ? check_rows.trapped : NULL, values,
+                               job.check ? expected : NULL, count, first_trap);
+        if (traps > 0)
+        {
+            if (result.traps == 0)
+            {
+                result.trap_offset = offset + first_trap;
+            }
+            result.traps += traps;
+            if (traps == count)
+            {
+                continue;
+            }
+        }
+
+        type low;
+        type high;
+        int matches;
+        if (count == BLOCK_SIZE)
+        {
+            reduce_block(values, job.check ? expected : NULL, BLOCK_SIZE, low, high, matches);
+        }
+        else
+        {
+            reduce_block(values, job.check ? expected : NULL, count, low, high, matches);
+        }
+        if (!result.any || low < decode<type>(result.min))
+        {
+            result.min = encode(mode, low);
+            result.min_offset = offset + find_value(values, rows.trapped, count, low);
+        }
+        if (!result.any || high > decode<type>(result.max))
+        {
+            result.max = encode(mode, high);
+            result.max_offset = offset + find_value(values, rows.trapped, count, high);
+        }
+        result.any = true;
+
+        if (job.check)
+        {
+            result.matches += matches - traps;
+            if (matches < count && !result.mismatched)
+            {
+                int index = std::mismatch(values, values + count, expected).first - values;
+                result.mismatched = true;
+                result.mismatch_offset = offset + index;
+                result.mismatch = encode(mode, values[index]);
+                result.expected = encode(mode, expected[index]);
+            }
+        }
+    }
+}
+
+MULTIVERSION
+static void sweep_range(const sweep & job, row_block & rows, row_block & check_rows,
+                        unsigned __int128 begin, unsigned __int128 end, sweep_result & result)
+{
+    switch (job.prog->mode)
+    {
+    case S8:
+        return sweep_range<int8_t>(job, rows, check_rows, begin, end, result);
+    case S16:
+        return sweep_range<int16_t>(job, rows, check_rows, begin, end, result);
+    case S32:
+        return sweep_range<int32_t>(job, rows, check_rows, begin, end, result);
+    case S64:
+        return sweep_range<int64_t>(job, rows, check_rows, begin, end, result);
+    case U8:
+        return sweep_range<uint8_t>(job, rows, check_rows, begin, end, result);
+    case U16:
+        return sweep_range<uint16_t>(job, rows, check_rows, begin, end, result);
+    case U32:
+        return sweep_range<uint32_t>(job, rows, check_rows, begin, end, result);
+    case U64:
+        return sweep_range<uint64_t>(job, rows, check_rows, begin, end, result);
+    default:
+        fprintf(stderr, "sweep_range: invalid encoding: %d\n", (int)job.prog->mode);
+        break;
+    }
+}
+
+static uint64_t widen(encoded_value value)
+/*! An integer's bits, sign extended in signed modes */
+{
+    int bits = 8 * encoding_sizes[value.encoding];
+    if (bits == 64)
+    {
+        return value.u64;
+    }
+    uint64_t bits_value = value.u64 & (((uint64_t)1 << bits) - 1);
+    if (value.encoding > S64)
+    {
+        return bits_value;
+    }
+    uint64_t sign = (uint64_t)1 << (bits - 1);
+    return (bits_value ^ sign) - sign;
+}
+
+static bool is_less(encoded_value a, encoded_value b)
+/*! Ordered as integers of the mode */
+{
+    if (a.encoding <= S64)
+    {
+        return (int64_t)widen(a) < (int64_t)widen(b);
+    }
+    return widen(a) < widen(b);
+}
+
+static bool parse_sweep_range(char * range, encoding_t mode, sweep & job)
+/*! "all", or first:last as literals in mode */
+{
+    int bits = 8 * encoding_sizes[mode];
+    encoded_value first = {};
+    encoded_value last = {};
+    first.encoding = last.encoding = mode;
+    if (strcmp(range, "all") == 0)
+    {
+        uint64_t top = (uint64_t)1 << (bits - 1);
+        first.u64 = mode <= S64 ? top : 0;
+        last.u64 = mode <= S64 ? top - 1 : top + (top - 1);
+    }
+    else
+    {
+        char * colon = strchr(range, ':');
+        if (!colon)
+        {
+            return false;
+        }
+        const char * cursor = range;
+        const char * end = colon + strlen(colon);
+        if (parse_value(cursor, colon, mode, first) != NO_ERROR ||
+            first.encoding == INVALID_ENCODING || cursor != colon)
+        {
+            return false;
+        }
+        cursor = colon + 1;
+        if (parse_value(cursor, end, mode, last) != NO_ERROR ||
+            last.encoding == INVALID_ENCODING || cursor != end)
+        {
+            return false;
+        }
+    }
+    if (is_less(last, first))
+    {
+        return false;
+    }
+    job.first = first;
+    job.first.u64 = widen(first);
+    job.size = (unsigned __int128)(widen(last) - widen(first)) + 1;
+    return true;
+}
+
+static std::string variable_name(const program & prog)
+{
+    if (prog.variables.empty())
+    {
+        return "";
+    }
+    const token & tok = prog.tokens[prog.variables[0]];
+    return std::string(prog.source.data() + tok.position, tok.end - tok.position);
+}
+
+static void append_value(output_buffer & out, encoded_value value)
+{
+    append_dec(out, value);
+    out.text += " (";
+    append_hex(out, value);
+    out.text += ')';
+}
+
+static void append_variable(output_buffer & out, const std::string & name, const sweep & job,
+                            uint64_t offset)
+{
+    encoded_value value = job.first;
+    value.u64 = job.first.u64 + offset;
+    out.text += name;
+    out.text += " = ";
+    append_value(out, value);
+}
+
+static void run_sweep(context & ctx, int jobs, const sweep & job)
+/*! Each thread takes an equal share of the range, and the shares'
+    results are combined in order, so ties go to the earliest value */
+{
+    std::vector<row_block> rows(jobs);
+    std::vector<row_block> check_rows(jobs);
+    std::vector<sweep_result> results(jobs);
+    for (int index = 0; index < jobs; index++)
+    {
+        init_row_block(rows[index], *job.prog);
+        init_row_block(check_rows[index], job.check ? *job.check : *job.prog);
+        results[index] = sweep_result();
+    }
+    auto task = [&](int index)
+    {
+        unsigned __int128 begin = job.size * index / jobs;
+        unsigned __int128 end = job.size * (index + 1) / jobs;
+        sweep_range(job, rows[index], check_rows[index], begin, end, results[index]);
+    };
+    if (jobs > 1)
+    {
+        worker_pool pool;
+        start_pool(pool, jobs);
+        run_pool(pool, task);
+        stop_pool(pool);
+    }
+    else
+    {
+        task(0);
+    }
+
+    sweep_result total = results[0];
+    for (int index = 0; index < jobs; index++)
+    {
+        const sweep_result & result = results[index];
+        free_row_block(rows[index]);
+        free_row_block(check_rows[index]);
+        if (index == 0)
+        {
+            continue;
+        }
+        if (total.traps == 0)
+        {
+            total.trap_offset = result.trap_offset;
+        }
+        total.traps += result.traps;
+        if (!result.any)
+        {
+            continue;
+        }
+        if (!total.any)
+        {
+            total.any = true;
+            total.min = result.min;
+            total.max = result.max;
+            total.min_offset = result.min_offset;
+            total.max_offset = result.max_offset;
+        }
+        if (is_less(result.min, total.min))
+        {
+            total.min = result.min;
+            total.min_offset = result.min_offset;
+        }
+        if (is_less(total.max, result.max))
+        {
+            total.max = result.max;
+            total.max_offset = result.max_offset;
+        }
+        total.matches += result.matches;
+        if (!total.mismatched && result.mismatched)
+        {
+            total.mismatched = true;
+            total.mismatch_offset = result.mismatch_offset;
+            total.mismatch = result.mismatch;
+            total.expected = result.expected;
+        }
+    }
+
+    std::string name = variable_name(*job.prog);
+    if (name.empty() && job.check)
+    {
+        name = variable_name(*job.check);
+    }
+    output_buffer & out = ctx.out;
+    char count[48];
+    uint64_t last_offset = (uint64_t)(job.size - 1);
+    if (job.size >> 64)
+    {
+        snprintf(count, sizeof count, "18446744073709551616");
+    }
+    else
+    {
+        snprintf(count, sizeof count, "%" PRIu64, (uint64_t)job.size);
+    }
+    append(out.text, "Values: %s, ", count);
+    append_variable(out, name, job, 0);
+    out.text += " to ";
+    append_variable(out, name, job, last_offset);
+    out.text += '\n';
+    if (total.any)
+    {
+        out.text += "Minimum: ";
+        append_value(out, total.min);
+        out.text += " at ";
+        append_variable(out, name, job, total.min_offset);
+        out.text += "\nMaximum: ";
+        append_value(out, total.max);
+        out.text += " at ";
+        append_variable(out, name, job, total.max_offset);
+        out.text += '\n';
+    }
+    if (total.traps > 0)
+    {
+        append(out.text, "Division traps: %" PRIu64 ", first at ", total.traps);
+        append_variable(out, name, job, total.trap_offset);
+        out.text += '\n';
+    }
+    if (job.check)
+    {
+        append(out.text, "Matches: %" PRIu64 " of %s\n", total.matches, count);
+        if (total.mismatched)
+        {
+            out.text += "First mismatch: ";
+            append_value(out, total.mismatch);
+            out.text += " != ";
+            append_value(out, total.expected);
+            out.text += " at ";
+            append_variable(out, name, job, total.mismatch_offset);
+            out.text += '\n';
+        }
+    }
+    write_output(ctx);
+}
+
+enum
+{
+    SERVER_READ_SIZE = 64 << 10,
+    SERVER_LINE_LIMIT = 1 << 20, /* Longest request before the connection is dropped */
+    SERVER_EVENTS = 64,
+};
+
+struct connection
+/*! A client socket, its input not yet answered and its responses not
+    yet sent. Listening sockets are connections too, so that every epoll
+    event carries one */
+{
+    int fd;
+    bool listening;
+    bool tcp;
+    bool closing;   /* The client closed its end; go once output is sent */
+    bool writing;   /* Waiting for EPOLLOUT rather than EPOLLIN */
+    std::string input;
+    std::string output;
+    size_t sent;
+};
+
+struct server
+/*! Each thread has its own epoll instance and calculator; the listening
+    sockets are in all of them, and a connection stays with the thread
+    that accepted it */
+{
+    encoding_t mode; /* For requests that don't start with a mode */
+    float_format_t float_format;
+    std::vector<connection *> listeners;
+};
+
+static int listen_unix(const char * path)
+{
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof address.sun_path)
+    {
+        fprintf(stderr, "Socket path too long: %s\n", path);
+        return -1;
+    }
+    strcpy(address.sun_path, path);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        perror("socket");
+        return -1;
+    }
+    unlink(path);
+    if (bind(fd, (sockaddr *)&address, sizeof address) < 0 || listen(fd, SOMAXCONN) < 0)
+    {
+        perror(path);
+        close(fd);
+        return -1;
+    }
+    return fd;
 }
 
-int main(int argc, char * argv[])
+static int listen_tcp(char * address)
+/*! [host:]port, the host defaulting to localhost */
 {
-    verbose = false;
-    if (argv[1] && strcmp(argv[1], "-v") == 0)
+    char * port = strrchr(address, ':');
+    const char * host = "localhost";
+    if (port)
+    {
+        *port++ = '\0';
+        host = address;
+    }
+    else
+    {
+        port = address;
+    }
+    addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    addrinfo * results;
+    int error = getaddrinfo(host, port, &hints, &results);
+    if (error)
+    {
+        fprintf(stderr, "%s:%s: %s\n", host, port, gai_strerror(error));
+        return -1;
+    }
+    int fd = -1;
+    for (addrinfo * result = results; result && fd < 0; result = result->ai_next)
     {
-        verbose = true;
-        argv++;
-        argc--;
+        fd = socket(result->ai_family, result->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                    result->ai_protocol);
+        if (fd < 0)
+        {
+            continue;
+        }
+        int on = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof on);
+        if (bind(fd, result->ai_addr, result->ai_addrlen) < 0 || listen(fd, SOMAXCONN) < 0)
+        {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(results);
+    if (fd < 0)
+    {
+        fprintf(stderr, "Can't listen on %s:%s\n", host, port);
     }
+    return fd;
+}
 
-    if (argc != 2)
+static void handle_request(const server & srv, bincalc_context * calc, const char * line,
+                           const char * end, std::string & out)
+/*! Answer "[mode] expression" with "dec (hex)", or "error: message at
+    offset" where the offset counts from the start of the request line.
+    A division that would trap is one of those errors, so no client's
+    request can take down the server and everyone else's connections */
+{
+    const char * cursor = line;
+    skip_whitespace(cursor, end);
+    const char * word = cursor;
+    while (cursor < end && !isspace(*cursor))
     {
-        usage(argv[0]);
-        return 1;
+        cursor++;
     }
-    encoding_t mode = parse_mode(argv[1]);
+    char name[8] = {};
+    if ((size_t)(cursor - word) < sizeof name)
+    {
+        memcpy(name, word, cursor - word);
+    }
+    encoding_t mode = parse_mode(name);
     if (mode == INVALID_ENCODING)
     {
-        usage(argv[0]);
-        return 1;
+        mode = srv.mode;
+        cursor = word;
+    }
+    if (mode == INVALID_ENCODING)
+    {
+        append(out, "error: Unknown mode at %d\n", (int)(word - line));
+        return;
+    }
+    bincalc_set_mode(calc, (bincalc_encoding)mode);
+    bincalc_value result;
+    bincalc_status status = bincalc_evaluate(calc, cursor, end - cursor, &result);
+    if (status != BINCALC_OK)
+    {
+        append(out, "error: %s at %d\n", bincalc_status_message(status),
+               (int)(cursor - line + bincalc_error_offset(calc)));
+        return;
+    }
+    char string[2 * BINCALC_FORMAT_SIZE + 4];
+    int size = bincalc_format_dec(calc, result, string);
+    string[size++] = ' ';
+    string[size++] = '(';
+    size += bincalc_format_hex(result, &string[size]);
+    string[size++] = ')';
+    string[size++] = '\n';
+    out.append(string, size);
+}
+
+static void close_connection(int epoll, connection * conn)
+{
+    epoll_ctl(epoll, EPOLL_CTL_DEL, conn->fd, NULL);
+    close(conn->fd);
+    delete conn;
+}
+
+static bool flush_connection(int epoll, connection * conn)
+/*! Send what the socket will take; while responses are left over,
+    wait for it to drain instead of reading more requests. Returns false
+    once the connection is closed */
+{
+    while (conn->sent < conn->output.size())
+    {
+        ssize_t count = send(conn->fd, conn->output.data() + conn->sent,
+                             conn->output.size() - conn->sent, MSG_NOSIGNAL);
+        if (count < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                break;
+            }
+            close_connection(epoll, conn);
+            return false;
+        }
+        conn->sent += count;
+    }
+    bool writing = conn->sent < conn->output.size();
+    if (!writing)
+    {
+        conn->output.clear();
+        conn->sent = 0;
+        if (conn->closing)
+        {
+            close_connection(epoll, conn);
+            return false;
+        }
+    }
+    if (writing != conn->writing)
+    {
+        epoll_event event = {};
+        event.events = writing ? EPOLLOUT : EPOLLIN;
+        event.data.ptr = conn;
+        epoll_ctl(epoll, EPOLL_CTL_MOD, conn->fd, &event);
+        conn->writing = writing;
+    }
+    return true;
+}
+
+static void accept_connections(int epoll, connection * listener)
+{
+    while (true)
+    {
+        int fd = accept4(listener->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+            {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                perror("accept");
+            }
+            return;
+        }
+        if (listener->tcp)
+        {
+            int on = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof on);
+        }
+        connection * conn = new connection {fd, false, listener->tcp};
+        epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.ptr = conn;
+        if (epoll_ctl(epoll, EPOLL_CTL_ADD, fd, &event) < 0)
+        {
+            perror("epoll_ctl");
+            close(fd);
+            delete conn;
+        }
+    }
+}
+
+static void read_requests(const server & srv, bincalc_context * calc, int epoll,
+                          connection * conn)
+/*! Answer every complete request line read so far, in order, so a
+    client can pipeline as many as it likes. At the end of the input a
+    last line without a newline is answered too */
+{
+    size_t old_size = conn->input.size();
+    conn->input.resize(old_size + SERVER_READ_SIZE);
+    ssize_t count = read(conn->fd, &conn->input[old_size], SERVER_READ_SIZE);
+    conn->input.resize(old_size + max(0, count));
+    if (count < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK))
+    {
+        return;
+    }
+    if (count <= 0)
+    {
+        conn->closing = true;
     }
 
+    const char * begin = conn->input.data();
+    const char * end = begin + conn->input.size();
+    const char * line = begin;
+    while (const char * newline = (const char *)memchr(line, '\n', end - line))
+    {
+        const char * line_end = newline;
+        if (line_end > line && line_end[-1] == '\r')
+        {
+            line_end--;
+        }
+        handle_request(srv, calc, line, line_end, conn->output);
+        line = newline + 1;
+    }
+    if (conn->closing && line < end)
+    {
+        handle_request(srv, calc, line, end[-1] == '\r' ? end - 1 : end, conn->output);
+        line = end;
+    }
+    conn->input.erase(0, line - begin);
+    if (conn->input.size() > SERVER_LINE_LIMIT)
+    {
+        append(conn->output, "error: Request too long at 0\n");
+        conn->input.clear();
+        conn->closing = true;
+    }
+    flush_connection(epoll, conn);
+}
+
+static void serve(const server & srv)
+/*! One thread's event loop, which never returns */
+{
+    int epoll = epoll_create1(EPOLL_CLOEXEC);
+    for (connection * listener : srv.listeners)
+    {
+        epoll_event event = {};
+        event.events = EPOLLIN | EPOLLEXCLUSIVE;
+        event.data.ptr = listener;
+        epoll_ctl(epoll, EPOLL_CTL_ADD, listener->fd, &event);
+    }
+    bincalc_context * calc = bincalc_create(BINCALC_S32);
+    bincalc_set_shortest_float(calc, srv.float_format == SHORTEST_FLOAT);
+    epoll_event events[SERVER_EVENTS];
+    while (true)
+    {
+        int count = epoll_wait(epoll, events, SERVER_EVENTS, -1);
+        for (int index = 0; index < count; index++)
+        {
+            connection * conn = (connection *)events[index].data.ptr;
+            if (conn->listening)
+            {
+                accept_connections(epoll, conn);
+            }
+            else if (conn->writing)
+            {
+                if (flush_connection(epoll, conn) && !conn->writing)
+                {
+                    /* Requests that arrived while sending are answered now */
+                    read_requests(srv, calc, epoll, conn);
+                }
+            }
+            else
+            {
+                read_requests(srv, calc, epoll, conn);
+            }
+        }
+    }
+}
+
+static bool run_server(context & ctx, int jobs, const char * socket_path, char * tcp_address)
+/*! Serve newline-separated "[mode] expression" requests on a Unix
+    socket, TCP, or both, with jobs threads */
+{
+    server srv = {ctx.mode, ctx.out.float_format};
+    int fds[2] = {socket_path ? listen_unix(socket_path) : -2,
+                  tcp_address ? listen_tcp(tcp_address) : -2};
+    for (int fd : fds)
+    {
+        if (fd == -1)
+        {
+            return false;
+        }
+        if (fd >= 0)
+        {
+            srv.listeners.push_back(new connection {fd, true, fd == fds[1]});
+        }
+    }
+    std::vector<std::thread> threads;
+    for (int thread = 1; thread < jobs; thread++)
+    {
+        threads.emplace_back(serve, std::cref(srv));
+    }
+    serve(srv);
+    return true;
+}
+
+struct line_history
+/*! Interactive history: at most size entries, and with a path, the
+    file shared with earlier sessions */
+{
+    int size;
+    const char * path;
+    bool existed; /* Whether the file was there to append to */
+    int added;    /* Entries added this session */
+};
+
+static void load_history(line_history & history)
+/*! Called as the first prompt is shown, so batch runs never read the file */
+{
+    using_history();
+    stifle_history(history.size);
+    if (history.path && history.size > 0)
+    {
+        int error = read_history(history.path);
+        history.existed = error == 0;
+        if (error && error != ENOENT)
+        {
+            fprintf(stderr, "%s: %s\n", history.path, strerror(error));
+        }
+    }
+}
+
+static void remember(line_history & history, const char * input)
+/*! Add input to the history unless it repeats the last entry */
+{
+    if (history.size == 0)
+    {
+        return;
+    }
+    HIST_ENTRY * last = history_get(history_base + history_length - 1);
+    if (last && strcmp(last->line, input) == 0)
+    {
+        return;
+    }
+    add_history(input);
+    history.added++;
+}
+
+static void save_history(const line_history & history)
+/*! Append this session's entries, so concurrent sessions don't lose
+    each other's, then trim the file to the size limit */
+{
+    if (!history.path || history.added == 0)
+    {
+        return;
+    }
+    int error = history.existed ? append_history(std::min(history.added, history_length),
+                                                 history.path)
+                                : write_history(history.path);
+    if (!error)
+    {
+        error = history_truncate_file(history.path, history.size);
+    }
+    if (error)
+    {
+        fprintf(stderr, "%s: %s\n", history.path, strerror(error));
+    }
+}
+
+static void run_interactive(context & ctx, line_history & history)
+/*! Each line readline returns is freed once evaluated; the history keeps
+    its own copy */
+{
+    load_history(history);
     while (true)
     {
         char * input = readline("> ");
@@ -734,20 +2913,430 @@ int main(int argc, char * argv[])
         {
             break;
         }
-        if (*input == '\00')
+        size_t size = strlen(input);
+        if (size == 0)
         {
+            free(input);
             continue;
         }
-        if (strcmp(input, "exit") == 0)
+        if (is_exit(input, size))
+        {
+            free(input);
+            break;
+        }
+        remember(history, input);
+        handle_input(input, size, ctx);
+        if (ctx.rows)
+        {
+            flush_rows(ctx);
+        }
+        write_output(ctx);
+        free(input);
+    }
+    save_history(history);
+}
+
+static bool compile_option(context & ctx, char * expression, program & prog)
+/*! Compile an expression given on the command line, binding variables */
+{
+    const char * cursor = expression;
+    status_t status = compile(cursor, expression + strlen(expression), ctx.mode, prog, true);
+    if (status != NO_ERROR)
+    {
+        fprintf(stderr, "  %s\n", expression);
+        report_error(ctx, expression, cursor, status);
+        write_output(ctx);
+        return false;
+    }
+    return true;
+}
+
+static bool read_trace(const char * path, float_format_t float_format)
+/*! Render a --trace file on stdout, each line's steps after its number */
+{
+    FILE * file = fopen(path, "rb");
+    if (!file)
+    {
+        perror(path);
+        return false;
+    }
+    char magic[sizeof TRACE_MAGIC];
+    bool valid = fread(magic, 1, sizeof magic, file) == sizeof magic &&
+                 memcmp(magic, TRACE_MAGIC, sizeof magic) == 0;
+    output_buffer out = {"", float_format};
+    std::vector<trace_step> steps;
+    trace_record record;
+    while (valid && fread(&record, sizeof record, 1, file) == 1)
+    {
+        valid = record.count <= UINT32_MAX;
+        if (valid)
+        {
+            steps.resize(record.count);
+            valid = fread(steps.data(), sizeof(trace_step), steps.size(), file) == steps.size();
+        }
+        for (size_t index = 0; valid && index < steps.size(); index++)
+        {
+            valid = steps[index].op < NUM_OPS && steps[index].encoding < NUM_ENCODINGS;
+        }
+        if (valid)
+        {
+            append(out.text, "line %" PRIu64 ":\n", record.line);
+            render_trace(out, steps.data(), steps.size());
+            fwrite(out.text.data(), 1, out.text.size(), stdout);
+            out.text.clear();
+        }
+    }
+    if (!valid)
+    {
+        fprintf(stderr, "%s: Not a complete trace file\n", path);
+    }
+    fclose(file);
+    return valid;
+}
+
+static void print_stats(const stats & counters, double seconds, uint64_t cycles, bool json)
+/*! To stderr; cycles is how many passed in seconds, to convert the
+    phase times */
+{
+    double ns_per_cycle = cycles ? seconds * 1e9 / cycles : 0;
+    std::string out;
+    if (json)
+    {
+        append(out, "{\"lines\": %" PRIu64 ", \"results\": %" PRIu64 ", "
+                    "\"parse_errors\": %" PRIu64 ", \"range_errors\": %" PRIu64 ", "
+                    "\"division_errors\": %" PRIu64 ", \"operators\": {",
+               counters.lines, counters.results, counters.parse_errors, counters.range_errors,
+               counters.division_errors);
+        const char * separator = "";
+        for (int op = 0; op < NUM_OPS; op++)
+        {
+            if (counters.operators[op])
+            {
+                append(out, "%s\"%s\": %" PRIu64, separator, operator_names[op],
+                       counters.operators[op]);
+                separator = ", ";
+            }
+        }
+        out += "}, \"ns\": {";
+        for (int phase = 0; phase < NUM_PHASES; phase++)
+        {
+            append(out, "\"%s\": %.0f, ", phase_names[phase], counters.cycles[phase] * ns_per_cycle);
+        }
+        append(out, "\"total\": %.0f}}\n", seconds * 1e9);
+    }
+    else
+    {
+        append(out, "Lines: %" PRIu64 ", results: %" PRIu64 ", parse errors: %" PRIu64
+                    ", range errors: %" PRIu64 ", division errors: %" PRIu64 "\n",
+               counters.lines, counters.results, counters.parse_errors, counters.range_errors,
+               counters.division_errors);
+        out += "Operators:";
+        const char * separator = " ";
+        for (int op = 0; op < NUM_OPS; op++)
+        {
+            if (counters.operators[op])
+            {
+                append(out, "%s%s %" PRIu64, separator, operator_names[op],
+                       counters.operators[op]);
+                separator = ", ";
+            }
+        }
+        out += "\nTime:";
+        for (int phase = 0; phase < NUM_PHASES; phase++)
+        {
+            append(out, " %s %.3f ms,", phase_names[phase], counters.cycles[phase] * ns_per_cycle / 1e6);
+        }
+        append(out, " total %.3f ms\n", seconds * 1e3);
+    }
+    fwrite(out.data(), 1, out.size(), stderr);
+}
+
+int main(int argc, char * argv[])
+{
+    context ctx = {INVALID_ENCODING, false, NULL, NULL};
+    ctx.out.float_format = FIXED_FLOAT;
+    bool batch = !isatty(STDIN_FILENO);
+    int jobs = 1;
+    bool jobs_set = false;
+    bool raw = false;
+    char * expression = NULL;
+    char * check = NULL;
+    char * range = NULL;
+    char * path = NULL;
+    char * socket_path = NULL;
+    char * tcp_address = NULL;
+    result_cache cache = {};
+    stats counters = {};
+    bool stats_json = false;
+    char * trace_path = NULL;
+    char * read_trace_path = NULL;
+    line_history history = {1000, NULL};
+    table columns = {};
+    enum
+    {
+        STATS_OPTION = 256,
+        TRACE_OPTION,
+        READ_TRACE_OPTION,
+        HISTORY_OPTION,
+        HISTORY_FILE_OPTION,
+        CSV_OPTION,
+        TSV_OPTION,
+    };
+    static const struct option long_options[] =
+    {
+        {"stats", optional_argument, NULL, STATS_OPTION},
+        {"trace", required_argument, NULL, TRACE_OPTION},
+        {"read-trace", required_argument, NULL, READ_TRACE_OPTION},
+        {"history", required_argument, NULL, HISTORY_OPTION},
+        {"history-file", required_argument, NULL, HISTORY_FILE_OPTION},
+        {"csv", optional_argument, NULL, CSV_OPTION},
+        {"tsv", optional_argument, NULL, TSV_OPTION},
+        {NULL, 0, NULL, 0},
+    };
+    int option;
+    while ((option = getopt_long(argc, argv, "+vsbrf:j:c:e:w:m:S:T:", long_options, NULL)) != -1)
+    {
+        switch (option)
         {
+        case TRACE_OPTION:
+            trace_path = optarg;
+            break;
+        case READ_TRACE_OPTION:
+            read_trace_path = optarg;
+            break;
+        case HISTORY_OPTION:
+            history.size = atoi(optarg);
+            if (history.size < 0)
+            {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case HISTORY_FILE_OPTION:
+            history.path = optarg;
+            break;
+        case CSV_OPTION:
+        case TSV_OPTION:
+            columns.delimiter = option == CSV_OPTION ? ',' : '\t';
+            columns.result_name = optarg ? optarg : "result";
+            ctx.columns = &columns;
+            break;
+        case STATS_OPTION:
+            if (optarg && strcmp(optarg, "json") != 0)
+            {
+                usage(argv[0]);
+                return 1;
+            }
+            stats_json = optarg != NULL;
+            ctx.counters = &counters;
+            break;
+        case 'v':
+            ctx.verbose = true;
+            break;
+        case 's':
+            ctx.out.float_format = SHORTEST_FLOAT;
+            break;
+        case 'b':
+            batch = true;
+            break;
+        case 'r':
+            raw = true;
+            break;
+        case 'f':
+            path = optarg;
+            break;
+        case 'j':
+            jobs = atoi(optarg);
+            jobs_set = true;
+            if (jobs < 1)
+            {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'c':
+            cache.capacity = atoi(optarg);
+            ctx.cache = &cache;
+            break;
+        case 'e':
+            expression = optarg;
+            break;
+        case 'w':
+            range = optarg;
+            break;
+        case 'm':
+            check = optarg;
+            break;
+        case 'S':
+            socket_path = optarg;
+            break;
+        case 'T':
+            tcp_address = optarg;
             break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (read_trace_path)
+    {
+        return read_trace(read_trace_path, ctx.out.float_format) ? 0 : 1;
+    }
+    std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+    uint64_t started_cycles = read_cycles();
+    bool serving = socket_path || tcp_address;
+    if (serving)
+    {
+        /* The mode is only a default for requests that don't give one */
+        encoding_t mode = argc - optind == 1 ? parse_mode(argv[optind]) : INVALID_ENCODING;
+        if (argc - optind > 1 || (argc - optind == 1 && mode == INVALID_ENCODING) ||
+            expression || path || raw || ctx.verbose || ctx.cache || trace_path || ctx.columns)
+        {
+            usage(argv[0]);
+            return 1;
+        }
+        ctx.mode = mode;
+        if (!jobs_set)
+        {
+            jobs = max(1, std::thread::hardware_concurrency());
+        }
+        return run_server(ctx, jobs, socket_path, tcp_address) ? 0 : 1;
+    }
+    if (argc - optind != 1)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    std::vector<encoding_t> modes;
+    if (!parse_modes(argv[optind], modes) || (expression && modes.size() > 1) ||
+        ((range || check) &&
+         (!expression || !range || modes[0] >= F32 || encoding_sizes[modes[0]] > 8)) ||
+        (raw && (!expression || range || ctx.verbose || trace_path)) || (trace_path && range) ||
+        (ctx.verbose && range) || (trace_path && ctx.cache) ||
+        (ctx.columns && (!expression || range || raw)))
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    ctx.mode = modes[0];
+    if (modes.size() > 1)
+    {
+        ctx.modes = &modes;
+    }
+
+    if (trace_path)
+    {
+        ctx.trace_file = fopen(trace_path, "wb");
+        if (!ctx.trace_file)
+        {
+            perror(trace_path);
+            return 1;
+        }
+        setvbuf(ctx.trace_file, NULL, _IOFBF, 1 << 20);
+        fwrite(TRACE_MAGIC, 1, sizeof TRACE_MAGIC, ctx.trace_file);
+    }
+
+    arena row_pool = {};
+    program row_prog(row_pool);
+    row_block row_storage;
+    if (expression)
+    {
+        if (!compile_option(ctx, expression, row_prog))
+        {
+            return 1;
+        }
+        if ((!ctx.verbose && !trace_path) || range)
+        {
+            optimize(row_prog);
         }
-        add_history(input);
-        bool success = handle_input(input, mode);
-        if (success)
+        init_row_block(row_storage, row_prog);
+        ctx.rows = &row_storage;
+    }
+
+    if (range)
+    {
+        sweep job = {&row_prog, NULL};
+        program check_prog(row_pool);
+        if (check)
+        {
+            if (!compile_option(ctx, check, check_prog))
+            {
+                return 1;
+            }
+            optimize(check_prog);
+            job.check = &check_prog;
+        }
+        std::string name = variable_name(row_prog);
+        std::string check_name = check ? variable_name(check_prog) : "";
+        if (row_prog.variables.size() > 1 || check_prog.variables.size() > 1 ||
+            (!name.empty() && !check_name.empty() && name != check_name))
+        {
+            fprintf(stderr, "A sweep needs a single variable\n");
+            return 1;
+        }
+        if (!parse_sweep_range(range, ctx.mode, job))
+        {
+            fprintf(stderr, "Invalid range for %s: %s\n", encoding_names[ctx.mode], range);
+            return 1;
+        }
+        if (!jobs_set)
+        {
+            jobs = max(1, std::thread::hardware_concurrency());
+        }
+        free_row_block(row_storage);
+        run_sweep(ctx, jobs, job);
+        free_arena(row_pool);
+        return 0;
+    }
+
+    int status = 0;
+    if (raw)
+    {
+        if (row_prog.variables.empty())
+        {
+            fprintf(stderr, "Raw rows need an expression with variables\n");
+            status = 1;
+        }
+        else
         {
-            add_history(input);
+            status = (path ? run_raw_mapped(ctx, path) : run_raw(ctx, STDIN_FILENO)) ? 0 : 1;
         }
     }
-    return 0;
+    else if (path)
+    {
+        status = run_mapped(ctx, jobs, path) ? 0 : 1;
+    }
+    else if (batch)
+    {
+        run_batch(ctx, jobs, STDIN_FILENO);
+    }
+    else
+    {
+        run_interactive(ctx, history);
+    }
+    if (ctx.rows)
+    {
+        free_row_block(row_storage);
+    }
+    free_arena(row_pool);
+    free_arena(ctx.pool);
+    if (ctx.trace_file && fclose(ctx.trace_file) != 0)
+    {
+        perror(trace_path);
+        status = 1;
+    }
+    if (ctx.cache)
+    {
+        fflush(stdout);
+        fprintf(stderr, "Cache: %" PRIu64 " hits, %" PRIu64 " misses\n", cache.hits, cache.misses);
+    }
+    if (ctx.counters)
+    {
+        fflush(stdout);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                                       started).count();
+        print_stats(counters, seconds, read_cycles() - started_cycles, stats_json);
+    }
+    return status;
 }
@@ -0,0 +1,199 @@
+/*! libbincalc: the bincalc calculator as a library, so programs can
+    evaluate expressions in-process.
+
+    All state lives in a bincalc_context, which holds the encoding,
+    output options, scratch memory and the details of the last error.
+    Contexts are independent of each other: use one per thread, or lock
+    around a shared one. A compiled bincalc_program is read-only once
+    compiled and can be run from any number of contexts at once.
+
+    Expressions are spans (pointer and size) and need not be
+    NUL-terminated. Errors are returned as a bincalc_status; call
+    bincalc_error_offset for where in the expression it happened.
+*/
+
+#ifndef BINCALC_H
+#define BINCALC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum bincalc_encoding
+{
+    BINCALC_S8, BINCALC_S16, BINCALC_S32, BINCALC_S64, BINCALC_S128,
+    BINCALC_U8, BINCALC_U16, BINCALC_U32, BINCALC_U64, BINCALC_U128,
+    BINCALC_F32, BINCALC_F64,
+    BINCALC_S8X16, BINCALC_S16X8, BINCALC_S32X4, BINCALC_S64X2,
+    BINCALC_U8X16, BINCALC_U16X8, BINCALC_U32X4, BINCALC_U64X2,
+    BINCALC_F32X4, BINCALC_F64X2,
+    BINCALC_INVALID_ENCODING = -1,
+} bincalc_encoding;
+
+typedef struct bincalc_value
+/*! A value and its encoding; read the member named after it */
+{
+    bincalc_encoding encoding;
+    union
+    {
+        int8_t s8;
+        int16_t s16;
+        int32_t s32;
+        int64_t s64;
+        __int128 s128;
+
+        uint8_t u8;
+        uint16_t u16;
+        uint32_t u32;
+        uint64_t u64;
+        unsigned __int128 u128;
+
+        float f32;
+        double f64;
+
+        int8_t s8x16[16];     /* Lane 0 first */
+        int16_t s16x8[8];
+        int32_t s32x4[4];
+        int64_t s64x2[2];
+        uint8_t u8x16[16];
+        uint16_t u16x8[8];
+        uint32_t u32x4[4];
+        uint64_t u64x2[2];
+        float f32x4[4];
+        double f64x2[2];
+    };
+} bincalc_value;
+
+typedef enum bincalc_status
+{
+    BINCALC_OK,
+    BINCALC_PARSE_ERROR,      /* Bad syntax or an operator the encoding lacks */
+    BINCALC_RANGE_ERROR,      /* A literal that doesn't fit the encoding */
+    BINCALC_INVALID_ARGUMENT, /* Wrong variable count or encodings */
+    BINCALC_NO_MEMORY,
+    BINCALC_DIVISION_ERROR,   /* An integer division by 0, or of the most negative value by -1 */
+} bincalc_status;
+
+enum
+{
+    BINCALC_FORMAT_SIZE = 656, /* Enough for any value bincalc_format_dec writes */
+};
+
+typedef struct bincalc_context bincalc_context;
+typedef struct bincalc_program bincalc_program;
+
+bincalc_context * bincalc_create(bincalc_encoding mode);
+/*! NULL when out of memory or the encoding is invalid */
+void bincalc_destroy(bincalc_context * ctx);
+
+void bincalc_set_mode(bincalc_context * ctx, bincalc_encoding mode);
+void bincalc_set_verbose(bincalc_context * ctx, int verbose);
+/*! With verbose set, each evaluation records its steps, as printed by
+    bincalc -v, for bincalc_trace */
+void bincalc_set_shortest_float(bincalc_context * ctx, int shortest);
+/*! Format floats with the fewest digits that read back to the same bits,
+    rather than six places after the point */
+
+bincalc_status bincalc_evaluate(bincalc_context * ctx, const char * expression, size_t size,
+                                bincalc_value * result);
+/*! Compile and evaluate a constant expression in the context's mode */
+
+bincalc_program * bincalc_compile(bincalc_context * ctx, const char * expression, size_t size,
+                                  bincalc_status * status);
+/*! Compile an expression that may name variables, for bincalc_run. Returns
+    NULL and sets *status on failure */
+size_t bincalc_variable_count(const bincalc_program * prog);
+const char * bincalc_variable_name(const bincalc_program * prog, size_t index, size_t * size);
+/*! Variables are numbered in order of first appearance; the name is not
+    NUL-terminated */
+bincalc_encoding bincalc_program_mode(const bincalc_program * prog);
+bincalc_status bincalc_run(bincalc_context * ctx, const bincalc_program * prog,
+                           const bincalc_value * variables, size_t count,
+                           bincalc_value * result);
+/*! variables holds count values, which must be bincalc_variable_count(prog)
+    in the program's encoding */
+void bincalc_free_program(bincalc_program * prog);
+
+size_t bincalc_error_offset(const bincalc_context * ctx);
+/*! Offset into the expression of the last error */
+const char * bincalc_trace(bincalc_context * ctx, size_t * size);
+/*! Steps of the last evaluation in verbose mode, one per line. They are
+    recorded as they happen but only formatted here, so tracing costs
+    little until it is asked for */
+const char * bincalc_status_message(bincalc_status status);
+
+int bincalc_format_dec(const bincalc_context * ctx, bincalc_value value, char * string);
+int bincalc_format_hex(bincalc_value value, char * string);
+/*! Both write at most BINCALC_FORMAT_SIZE bytes, NUL-terminated, and
+    return the length */
+
+bincalc_encoding bincalc_parse_mode(const char * name);
+/*! "s8" through "f64", including "s128" and "u128", and the packed
+    "s8x16" through "f64x2"; BINCALC_INVALID_ENCODING otherwise */
+const char * bincalc_mode_name(bincalc_encoding mode);
+
+#ifdef __cplusplus
+}
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace bincalc
+{
+
+class calculator
+/*! Owns a bincalc_context */
+{
+public:
+    explicit calculator(bincalc_encoding mode = BINCALC_S32) : ctx(bincalc_create(mode)) {}
+    ~calculator() { bincalc_destroy(ctx); }
+    calculator(const calculator &) = delete;
+    calculator & operator=(const calculator &) = delete;
+
+    bincalc_context * get() const { return ctx; }
+    bool valid() const { return ctx != NULL; }
+
+    void set_mode(bincalc_encoding mode) { bincalc_set_mode(ctx, mode); }
+    void set_verbose(bool verbose) { bincalc_set_verbose(ctx, verbose); }
+    void set_shortest_float(bool shortest) { bincalc_set_shortest_float(ctx, shortest); }
+
+    bincalc_status evaluate(std::string_view expression, bincalc_value & result)
+    {
+        return bincalc_evaluate(ctx, expression.data(), expression.size(), &result);
+    }
+    bincalc_status run(const bincalc_program * prog, const std::vector<bincalc_value> & variables,
+                       bincalc_value & result)
+    {
+        return bincalc_run(ctx, prog, variables.data(), variables.size(), &result);
+    }
+
+    size_t error_offset() const { return bincalc_error_offset(ctx); }
+    std::string_view trace()
+    {
+        size_t size;
+        const char * text = bincalc_trace(ctx, &size);
+        return std::string_view(text, size);
+    }
+    std::string format_dec(bincalc_value value) const
+    {
+        char string[BINCALC_FORMAT_SIZE];
+        return std::string(string, bincalc_format_dec(ctx, value, string));
+    }
+    static std::string format_hex(bincalc_value value)
+    {
+        char string[BINCALC_FORMAT_SIZE];
+        return std::string(string, bincalc_format_hex(value, string));
+    }
+
+private:
+    bincalc_context * ctx;
+};
+
+}
+#endif
+
+#endif
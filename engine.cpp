@@ -0,0 +1,2113 @@
+/*! The bincalc expression engine; see engine.h */
+
+#include <ctype.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <math.h>
+
+#include <map>
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <limits>
+#include <type_traits>
+
+#include "engine.h"
+
+namespace bincalc::engine
+{
+
+const char * const encoding_names[NUM_ENCODINGS] =
+{ "s8", "s16", "s32", "s64", "s128",
+  "u8", "u16", "u32", "u64", "u128",
+  "f32", "f64",
+  "s8x16", "s16x8", "s32x4", "s64x2",
+  "u8x16", "u16x8", "u32x4", "u64x2",
+  "f32x4", "f64x2" };
+
+const int encoding_sizes[NUM_ENCODINGS] =
+{ 1, 2, 4, 8, 16,
+  1, 2, 4, 8, 16,
+  4, 8,
+  16, 16, 16, 16,
+  16, 16, 16, 16,
+  16, 16 };
+
+const int lane_counts[NUM_ENCODINGS] =
+{ 1, 1, 1, 1, 1,
+  1, 1, 1, 1, 1,
+  1, 1,
+  16, 8, 4, 2,
+  16, 8, 4, 2,
+  4, 2 };
+
+const encoding_t lane_encodings[NUM_ENCODINGS] =
+{ S8, S16, S32, S64, S128,
+  U8, U16, U32, U64, U128,
+  F32, F64,
+  S8, S16, S32, S64,
+  U8, U16, U32, U64,
+  F32, F64 };
+
+static const encoded_value INVALID_VALUE = {INVALID_ENCODING};
+
+void append(std::string & out, const char * format, ...)
+/*! printf onto the end of out */
+{
+    char string[256];
+    va_list args;
+    va_start(args, format);
+    int size = vsnprintf(string, sizeof string, format, args);
+    va_end(args);
+    if (size < (int)sizeof string)
+    {
+        out.append(string, size);
+        return;
+    }
+    size_t old_size = out.size();
+    out.resize(old_size + size + 1);
+    va_start(args, format);
+    vsnprintf(&out[old_size], size + 1, format, args);
+    va_end(args);
+    out.resize(old_size + size);
+}
+
+void * arena_alloc(arena & pool, size_t size, size_t align)
+{
+    while (pool.current < pool.blocks.size())
+    {
+        size_t offset = (pool.used + align - 1) & ~(align - 1);
+        if (offset + size <= pool.sizes[pool.current])
+        {
+            pool.used = offset + size;
+            return pool.blocks[pool.current] + offset;
+        }
+        pool.current++;
+        pool.used = 0;
+    }
+    size_t block_size = std::max<size_t>(ARENA_BLOCK_SIZE, size);
+    char * block = (char *)malloc(block_size);
+    if (!block)
+    {
+        throw std::bad_alloc();
+    }
+    pool.blocks.push_back(block);
+    pool.sizes.push_back(block_size);
+    pool.current = pool.blocks.size() - 1;
+    pool.used = size;
+    return block;
+}
+
+void reset_arena(arena & pool)
+{
+    pool.current = 0;
+    pool.used = 0;
+}
+
+void free_arena(arena & pool)
+{
+    for (char * block : pool.blocks)
+    {
+        free(block);
+    }
+    pool.blocks.clear();
+    pool.sizes.clear();
+    reset_arena(pool);
+}
+
+void skip_whitespace(const char *& cursor, const char * end)
+{
+    while (cursor < end && isspace(*cursor))
+    {
+        cursor++;
+    }
+}
+
+struct operator_lookup_table
+/*! First character to operator, one table for operand positions (unary)
+    and one for operator positions (binary, and sentinels) */
+{
+    operator_t ops[2][256];
+    int sizes[NUM_OPS];
+};
+
+static operator_lookup_table build_operator_lookup()
+{
+    operator_lookup_table lookup;
+    for (int arity = 0; arity < 2; arity++)
+    {
+        for (int c = 0; c < 256; c++)
+        {
+            lookup.ops[arity][c] = INVALID_OP;
+        }
+    }
+    for (int op = 0; op < NUM_OPS; op++)
+    {
+        int arity = operator_table[op].arity == UNARY ? UNARY : BINARY;
+        const char * identifier = operator_table[op].identifier;
+        lookup.ops[arity][(unsigned char)identifier[0]] = (operator_t)op;
+        lookup.sizes[op] = max(1, strlen(identifier));
+    }
+    return lookup;
+}
+
+static const operator_lookup_table operator_lookup = build_operator_lookup();
+
+static operator_t lex_operator(const char *& cursor, const char * end, arity_t arity)
+/*! arity is UNARY or BINARY; the sentinels ")" and end of input are
+    found in BINARY position. Returns INVALID_OP if nothing matches.
+    The end of input reads as a NUL, which is consumed like any other
+    operator character */
+{
+    unsigned char c = cursor < end ? *cursor : '\00';
+    operator_t op = operator_lookup.ops[arity][c];
+    if (op == INVALID_OP)
+    {
+        return INVALID_OP;
+    }
+    int size = operator_lookup.sizes[op];
+    if (size == 2 && (cursor + 1 >= end || cursor[1] != operator_table[op].identifier[1]))
+    {
+        return INVALID_OP;
+    }
+    cursor += size;
+    return op;
+}
+
+/* The literal parsers below leave cursor alone if there is no literal,
+   and return false if there is one but it is out of range */
+
+template <typename type>
+static bool parse_int(const char *& cursor, const char * end, int128_t min, int128_t max,
+                      type & value)
+/*! Accepts what strtoll does in base 10, including a leading "+" */
+{
+    const char * start = cursor;
+    if (start < end && *start == '+' && start + 1 < end && isdigit(start[1]))
+    {
+        start++;
+    }
+    std::from_chars_result result = std::from_chars(start, end, value);
+    if (result.ptr == start)
+    {
+        return true;
+    }
+    cursor = result.ptr;
+    return result.ec == std::errc() && min <= value && value <= max;
+}
+
+template <typename type>
+static bool parse_uint(const char *& cursor, const char * end, uint128_t max, type & value)
+{
+    const char * start = cursor;
+    if (start + 1 < end && (*start == '+' || *start == '-') && isdigit(start[1]))
+    {
+        if (*start == '-')
+        {
+            return false;
+        }
+        start++;
+    }
+    std::from_chars_result result = std::from_chars(start, end, value);
+    if (result.ptr == start)
+    {
+        return true;
+    }
+    cursor = result.ptr;
+    return result.ec == std::errc() && value <= max;
+}
+
+static float strtox_real(const char * string, char ** end, float)
+{
+    return strtof(string, end);
+}
+
+static double strtox_real(const char * string, char ** end, double)
+{
+    return strtod(string, end);
+}
+
+template <typename type>
+static bool parse_real(const char *& cursor, const char * end, type & value)
+/*! Accepts what strtof/strtod do: a sign, then decimal digits, inf or
+    nan. Like them, results that overflow, or underflow and so lose
+    precision, are out of range. Hex floats and nan payloads are rare, so
+    those are simply handed to strtof/strtod */
+{
+    const char * start = cursor;
+    bool negative = start < end && *start == '-';
+    if (start < end && (*start == '-' || *start == '+'))
+    {
+        start++;
+    }
+    if ((end - start > 1 && start[0] == '0' && (start[1] | 0x20) == 'x') ||
+        (end - start > 3 && strncasecmp(start, "nan(", 4) == 0))
+    {
+        char string[128];
+        size_t size = std::min<size_t>(end - cursor, sizeof string - 1);
+        memcpy(string, cursor, size);
+        string[size] = '\00';
+        char * string_end;
+        int old_errno = errno;
+        errno = 0;
+        value = strtox_real(string, &string_end, type());
+        bool in_range = errno != ERANGE;
+        errno = old_errno;
+        cursor += string_end - string;
+        return in_range;
+    }
+    if (start < end && (*start == '-' || *start == '+'))
+    {
+        return true;
+    }
+    std::from_chars_result result = std::from_chars(start, end, value);
+    if (result.ptr == start)
+    {
+        return true;
+    }
+    cursor = result.ptr;
+    if (negative)
+    {
+        value = -value;
+    }
+    return result.ec == std::errc() && std::fpclassify(value) != FP_SUBNORMAL;
+}
+
+static uint64_t hex_swar_digits(uint64_t chars)
+/*! Count how many of the 8 characters in chars (first in the low byte)
+    are hex digits before the first one that isn't */
+{
+    const uint64_t ones = 0x0101010101010101ull;
+    const uint64_t highs = 0x8080808080808080ull;
+    /* For bytes below 0x80, the high bit of x + (0x80 - lo) is set when
+       x >= lo, and that of x + (0x7f - hi) when x > hi */
+    uint64_t ascii = ~chars & highs;
+    uint64_t low = chars & ~highs;
+    uint64_t folded = low | 0x20 * ones;
+    uint64_t digit = (low + (0x80 - '0') * ones) & ~(low + (0x7f - '9') * ones);
+    uint64_t alpha = (folded + (0x80 - 'a') * ones) & ~(folded + (0x7f - 'f') * ones);
+    uint64_t invalid = ~(digit | alpha) & ascii;
+    invalid |= ~ascii & highs;
+    return invalid ? __builtin_ctzll(invalid) / 8 : 8;
+}
+
+static uint64_t hex_swar_value(uint64_t chars, int digits)
+/*! Decode the first digits (1 to 8) hex characters in chars */
+{
+    const uint64_t ones = 0x0101010101010101ull;
+    uint64_t nibbles = (chars & 0x0f * ones) + ((chars >> 6) & ones) * 9;
+    if (digits < 8)
+    {
+        nibbles &= ~0ull >> (64 - 8 * digits);
+    }
+    /* Pack pairs of nibbles, then bytes, then 16-bit halves; each step
+       puts the earlier (more significant) character on top */
+    nibbles = ((nibbles << 4) | (nibbles >> 8)) & 0x00ff00ff00ff00ffull;
+    nibbles = ((nibbles << 8) | (nibbles >> 16)) & 0x0000ffff0000ffffull;
+    nibbles = ((nibbles << 16) | (nibbles >> 32)) & 0xffffffffull;
+    return nibbles >> (4 * (8 - digits));
+}
+
+static int digit_to_int(int c)
+{
+    return '0' <= c && c <= '9' ? c - '0' :
+           'a' <= c && c <= 'f' ? c - 'a' + 10 :
+           'A' <= c && c <= 'F' ? c - 'A' + 10 : 0;
+}
+
+template <typename type>
+static bool strtox(const char *& cursor, const char * end, int max_digits, type & value)
+/*! Unfortunately, strtol forces you to use "0x" as a prefix, so
+    rather than hack around it; I'm going to reimplement it with
+    an "x" prefix. Digits are decoded eight at a time while at least
+    eight characters remain; type is uint64_t, or uint128_t for up to
+    32 digits */
+{
+    value = 0;
+    if (cursor + 1 >= end || cursor[0] != 'x' || !isxdigit(cursor[1]))
+    {
+        return true;
+    }
+    const char * digit = cursor + 1;
+    while (digit < end && *digit == '0')
+    {
+        digit++;
+    }
+    int digits = 0;
+    while (end - digit >= 8)
+    {
+        uint64_t chars;
+        memcpy(&chars, digit, sizeof chars);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        chars = __builtin_bswap64(chars);
+#endif
+        int count = hex_swar_digits(chars);
+        if (count == 0)
+        {
+            break;
+        }
+        digits += count;
+        if (digits > max_digits)
+        {
+            return false;
+        }
+        value = (count == 8 ? value << 32 : value << (4 * count)) | hex_swar_value(chars, count);
+        digit += count;
+        if (count < 8)
+        {
+            break;
+        }
+    }
+    for (; digit < end && isxdigit(*digit); digit++)
+    {
+        if (++digits > max_digits)
+        {
+            return false;
+        }
+        value = value << 4 | digit_to_int(*digit);
+    }
+    cursor = digit;
+    return true;
+}
+
+const char * status_message(status_t status)
+{
+    switch (status)
+    {
+    case NO_ERROR:
+        return "Success";
+    case PARSE_ERROR:
+        return "Parse error";
+    case RANGE_ERROR:
+        return "Value out of range";
+    case DIVISION_ERROR:
+        return "Division traps";
+    default:
+        return "Unknown error";
+    }
+}
+
+static status_t parse_packed(const char *& cursor, const char * end, encoding_t mode,
+                             encoded_value & value)
+/*! "x" and up to 32 hex digits for the whole register, lane 0 in the
+    lowest bits; "{a, b, ...}" with a literal for each lane, lane 0
+    first; or any other literal of the lanes' encoding, for every lane */
+{
+    encoding_t lane_mode = lane_encodings[mode];
+    int size = encoding_sizes[lane_mode];
+    int lanes = lane_counts[mode];
+    char * bits = (char *)&value.u128;
+    if (cursor < end && *cursor == 'x')
+    {
+        return strtox(cursor, end, 32, value.u128) ? NO_ERROR : RANGE_ERROR;
+    }
+    encoded_value lane;
+    if (cursor < end && *cursor != '{')
+    {
+        status_t status = parse_value(cursor, end, lane_mode, lane);
+        for (int index = 0; index < lanes; index++)
+        {
+            memcpy(bits + index * size, &lane.u128, size);
+        }
+        return status;
+    }
+    /* Left where it is unless the whole list parses */
+    const char * next = cursor + 1;
+    for (int index = 0; index < lanes; index++)
+    {
+        if (index > 0)
+        {
+            skip_whitespace(next, end);
+            if (next == end || *next != ',')
+            {
+                return NO_ERROR;
+            }
+            next++;
+        }
+        if (parse_value(next, end, lane_mode, lane) != NO_ERROR)
+        {
+            return RANGE_ERROR;
+        }
+        if (lane.encoding == INVALID_ENCODING)
+        {
+            return NO_ERROR;
+        }
+        memcpy(bits + index * size, &lane.u128, size);
+    }
+    skip_whitespace(next, end);
+    if (next == end || *next != '}')
+    {
+        return NO_ERROR;
+    }
+    cursor = next + 1;
+    return NO_ERROR;
+}
+
+status_t parse_value(const char *& cursor, const char * end, encoding_t mode,
+                     encoded_value & value)
+/*! end is one past the last character the literal may use. value is
+    INVALID_VALUE if there is no literal there; on a range error cursor
+    is left at the start of the literal */
+{
+    skip_whitespace(cursor, end);
+    value.encoding = mode;
+    if (lane_counts[mode] > 1)
+    {
+        const char * old_cursor = cursor;
+        status_t status = parse_packed(cursor, end, mode, value);
+        if (status != NO_ERROR)
+        {
+            cursor = old_cursor;
+        }
+        else if (cursor == old_cursor)
+        {
+            value = INVALID_VALUE;
+        }
+        return status;
+    }
+
+    const char * old_cursor = cursor;
+    bool in_range = true;
+    uint64_t bits;
+    if (cursor < end && *cursor == 'x')
+    {
+        switch (mode)
+        {
+        case S8:
+        case U8:
+            in_range = strtox(cursor, end, 2, bits);
+            value.u8 = bits;
+            break;
+        case S16:
+        case U16:
+            in_range = strtox(cursor, end, 4, bits);
+            value.u16 = bits;
+            break;
+        case S32:
+        case U32:
+        case F32:
+            in_range = strtox(cursor, end, 8, bits);
+            value.u32 = bits;
+            break;
+        case S64:
+        case U64:
+        case F64:
+            in_range = strtox(cursor, end, 16, bits);
+            value.u64 = bits;
+            break;
+        case S128:
+        case U128:
+            in_range = strtox(cursor, end, 32, value.u128);
+            break;
+        default:
+            fprintf(stderr, "parse_value: Invalid mode: %d\n", (int)mode);
+            break;
+        }
+    }
+    else
+    {
+        int64_t integer = 0;
+        uint64_t natural = 0;
+        switch (mode)
+        {
+        case S8:
+            in_range = parse_int(cursor, end, INT8_MIN, INT8_MAX, integer);
+            value.s8 = integer;
+            break;
+        case S16:
+            in_range = parse_int(cursor, end, INT16_MIN, INT16_MAX, integer);
+            value.s16 = integer;
+            break;
+        case S32:
+            in_range = parse_int(cursor, end, INT32_MIN, INT32_MAX, integer);
+            value.s32 = integer;
+            break;
+        case S64:
+            in_range = parse_int(cursor, end, INT64_MIN, INT64_MAX, integer);
+            value.s64 = integer;
+            break;
+        case S128:
+            in_range = parse_int(cursor, end, std::numeric_limits<int128_t>::min(),
+                                 std::numeric_limits<int128_t>::max(), value.s128);
+            break;
+        case U8:
+            in_range = parse_uint(cursor, end, UINT8_MAX, natural);
+            value.u8 = natural;
+            break;
+        case U16:
+            in_range = parse_uint(cursor, end, UINT16_MAX, natural);
+            value.u16 = natural;
+            break;
+        case U32:
+            in_range = parse_uint(cursor, end, UINT32_MAX, natural);
+            value.u32 = natural;
+            break;
+        case U64:
+            in_range = parse_uint(cursor, end, UINT64_MAX, natural);
+            value.u64 = natural;
+            break;
+        case U128:
+            in_range = parse_uint(cursor, end, std::numeric_limits<uint128_t>::max(),
+                                  value.u128);
+            break;
+        case F32:
+            in_range = parse_real(cursor, end, value.f32);
+            break;
+        case F64:
+            in_range = parse_real(cursor, end, value.f64);
+            break;
+        default:
+            fprintf(stderr, "parse_value: Invalid mode: %d\n", (int)mode);
+            break;
+        }
+    }
+
+    if (!in_range)
+    {
+        cursor = old_cursor;
+        return RANGE_ERROR;
+    }
+    if (old_cursor == cursor)
+    {
+        value = INVALID_VALUE;
+    }
+    return NO_ERROR;
+}
+
+static void format_hex_digits(uint64_t bits, char * string, int digits)
+/*! The low digits hex digits of bits, most significant first */
+{
+    static const char hex_digits[] = "0123456789abcdef";
+    for (int digit = digits - 1; digit >= 0; digit--)
+    {
+        string[digit] = hex_digits[bits & 0xf];
+        bits >>= 4;
+    }
+}
+
+static int format_packed(encoded_value value, char * string, bool hex,
+                         float_format_t float_format)
+/*! "{lane 0, lane 1, ...}", each formatted as its own encoding */
+{
+    encoding_t lane_mode = lane_encodings[value.encoding];
+    int size = encoding_sizes[lane_mode];
+    const char * bits = (const char *)&value.u128;
+    int length = 0;
+    string[length++] = '{';
+    for (int index = 0; index < lane_counts[value.encoding]; index++)
+    {
+        if (index > 0)
+        {
+            string[length++] = ',';
+            string[length++] = ' ';
+        }
+        encoded_value lane = {lane_mode};
+        memcpy(&lane.u128, bits + index * size, size);
+        length += hex ? format_hex(lane, &string[length])
+                      : format_dec(lane, &string[length], float_format);
+    }
+    string[length++] = '}';
+    string[length] = '\00';
+    return length;
+}
+
+int format_hex(encoded_value value, char * string)
+/*! Write "x" and two digits per byte of the encoding, NUL-terminated;
+    returns the length. Packed encodings are written lane by lane */
+{
+    if (value.encoding < 0 || value.encoding >= NUM_ENCODINGS)
+    {
+        fprintf(stderr, "Invalid encoding: %d\n", value.encoding);
+        string[0] = '\00';
+        return 0;
+    }
+    if (lane_counts[value.encoding] > 1)
+    {
+        return format_packed(value, string, true, FIXED_FLOAT);
+    }
+    int digits = 2 * encoding_sizes[value.encoding];
+    string[0] = 'x';
+    if (digits > 16)
+    {
+        format_hex_digits(value.u128 >> 64, &string[1], digits - 16);
+        format_hex_digits(value.u128, &string[1 + digits - 16], 16);
+    }
+    else
+    {
+        format_hex_digits(value.u64, &string[1], digits);
+    }
+    string[digits + 1] = '\00';
+    return digits + 1;
+}
+
+template <typename type>
+static int format_to_chars(type value, char * string)
+/*! For floating-point types, std::to_chars gives the shortest
+    round-trip representation */
+{
+    char * end = std::to_chars(string, string + FORMAT_SIZE - 1, value).ptr;
+    *end = '\00';
+    return end - string;
+}
+
+static int format_digits(uint64_t value, char * string, int digits)
+/*! Exactly digits decimal digits, with leading zeros */
+{
+    for (int digit = digits - 1; digit >= 0; digit--)
+    {
+        string[digit] = '0' + value % 10;
+        value /= 10;
+    }
+    return digits;
+}
+
+static int format_uint128(uint128_t value, char * string)
+/*! std::to_chars takes a 128-bit division for every two digits, and
+    printf can't print these at all. Splitting into 19 digit chunks
+    takes at most two, leaving the rest to 64-bit arithmetic */
+{
+    const uint64_t chunk = UINT64_C(10000000000000000000);
+    if (value <= UINT64_MAX)
+    {
+        return format_to_chars((uint64_t)value, string);
+    }
+    uint64_t low = value % chunk;
+    value /= chunk;
+    int size;
+    if (value <= UINT64_MAX)
+    {
+        size = format_to_chars((uint64_t)value, string);
+    }
+    else
+    {
+        uint64_t middle = value % chunk;
+        size = format_to_chars((uint64_t)(value / chunk), string);
+        size += format_digits(middle, &string[size], 19);
+    }
+    size += format_digits(low, &string[size], 19);
+    string[size] = '\00';
+    return size;
+}
+
+static int format_int128(int128_t value, char * string)
+{
+    if (value >= 0)
+    {
+        return format_uint128(value, string);
+    }
+    string[0] = '-';
+    return 1 + format_uint128(-(uint128_t)value, &string[1]);
+}
+
+int format_dec(encoded_value value, char * string,
+               float_format_t float_format)
+/*! NUL-terminated; returns the length */
+{
+    if (value.encoding > F64 && value.encoding < NUM_ENCODINGS)
+    {
+        return format_packed(value, string, false, float_format);
+    }
+    switch (value.encoding)
+    {
+    case S8:
+        return format_to_chars(value.s8, string);
+    case S16:
+        return format_to_chars(value.s16, string);
+    case S32:
+        return format_to_chars(value.s32, string);
+    case S64:
+        return format_to_chars(value.s64, string);
+    case S128:
+        return format_int128(value.s128, string);
+    case U8:
+        return format_to_chars(value.u8, string);
+    case U16:
+        return format_to_chars(value.u16, string);
+    case U32:
+        return format_to_chars(value.u32, string);
+    case U64:
+        return format_to_chars(value.u64, string);
+    case U128:
+        return format_uint128(value.u128, string);
+    case F32:
+        if (float_format == SHORTEST_FLOAT)
+        {
+            return format_to_chars(value.f32, string);
+        }
+        return snprintf(string, FORMAT_SIZE, "%f", value.f32);
+    case F64:
+        if (float_format == SHORTEST_FLOAT)
+        {
+            return format_to_chars(value.f64, string);
+        }
+        return snprintf(string, FORMAT_SIZE, "%lf", value.f64);
+    default:
+        fprintf(stderr, "Invalid encoding: %d\n", value.encoding);
+        string[0] = '\00';
+        return 0;
+    }
+}
+
+void append_dec(output_buffer & out, encoded_value value)
+{
+    char string[FORMAT_SIZE];
+    out.text.append(string, format_dec(value, string, out.float_format));
+}
+
+void append_hex(output_buffer & out, encoded_value value)
+{
+    char string[FORMAT_SIZE];
+    out.text.append(string, format_hex(value, string));
+}
+
+template <typename lane>
+struct packed
+/*! A 128-bit register of lanes. GCC's vector extensions apply the
+    operators lane-wise, wrapping at the lane's width, and compile them
+    to the target's SIMD instructions (SSE, AVX or NEON) where it has
+    them, so evaluate_operator_integer and evaluate_operator_real work
+    on these as they are */
+{
+    typedef lane vector __attribute__((vector_size(16)));
+    vector lanes;
+};
+
+#define PACKED_OPERATOR(symbol) \
+    template <typename lane> \
+    static packed<lane> operator symbol(packed<lane> left, packed<lane> right) \
+    { \
+        return {left.lanes symbol right.lanes}; \
+    }
+
+PACKED_OPERATOR(+)
+PACKED_OPERATOR(-)
+PACKED_OPERATOR(*)
+PACKED_OPERATOR(/)
+PACKED_OPERATOR(%)
+PACKED_OPERATOR(&)
+PACKED_OPERATOR(|)
+PACKED_OPERATOR(^)
+
+#undef PACKED_OPERATOR
+
+template <typename lane>
+static packed<lane> operator-(packed<lane> value)
+{
+    return {-value.lanes};
+}
+
+template <typename lane>
+static packed<lane> operator~(packed<lane> value)
+{
+    return {~value.lanes};
+}
+
+template <typename lane>
+static typename packed<lane>::vector shift_in_range(packed<lane> amounts)
+/*! All ones in lanes whose shift amount, taken as unsigned, is less
+    than the lane's width */
+{
+    typedef std::make_unsigned_t<lane> natural;
+    typedef natural naturals __attribute__((vector_size(16)));
+    return (typename packed<lane>::vector)((naturals)amounts.lanes < (natural)(8 * sizeof(lane)));
+}
+
+template <typename lane>
+static packed<lane> operator<<(packed<lane> left, packed<lane> right)
+/*! Shifts by the lane's width or more give 0, as PSLLV and VSHL do */
+{
+    const lane top = 8 * sizeof(lane) - 1;
+    return {(left.lanes << (right.lanes & top)) & shift_in_range(right)};
+}
+
+template <typename lane>
+static packed<lane> operator>>(packed<lane> left, packed<lane> right)
+/*! Shifts by the lane's width or more give 0 in unsigned lanes, and
+    copies of the sign bit in signed ones, as PSRLV, PSRAV and VSHL do */
+{
+    const lane top = 8 * sizeof(lane) - 1;
+    typename packed<lane>::vector in_range = shift_in_range(right);
+    if constexpr (std::is_signed_v<lane>)
+    {
+        return {left.lanes >> ((right.lanes & in_range) | (top & ~in_range))};
+    }
+    else
+    {
+        return {(left.lanes >> (right.lanes & top)) & in_range};
+    }
+}
+
+template <typename type>
+static bool may_trap(type divisor)
+/*! Whether dividing by divisor can trap: by 0, or by -1 with the most
+    negative dividend */
+{
+    return divisor == 0 || (type)(divisor + 1) == 0;
+}
+
+template <typename lane>
+static bool may_trap(packed<lane> divisor)
+{
+    bool trap = false;
+    for (int index = 0; index < (int)(16 / sizeof(lane)); index++)
+    {
+        trap |= may_trap<lane>(divisor.lanes[index]);
+    }
+    return trap;
+}
+
+template <typename lane>
+static bool division_traps(packed<lane> left, packed<lane> right)
+/*! Whether any lane's division would */
+{
+    bool trap = false;
+    for (int index = 0; index < (int)(16 / sizeof(lane)); index++)
+    {
+        trap |= division_traps<lane>(left.lanes[index], right.lanes[index]);
+    }
+    return trap;
+}
+
+static void trace_operator(output_buffer & trace, operator_t op, encoded_value value,
+                           encoded_value result)
+{
+    /* op(value) = result (opvalue = result), in decimal then hex */
+    const char * identifier = operator_table[op].identifier;
+    trace.text += identifier;
+    trace.text += '(';
+    append_dec(trace, value);
+    trace.text += ") = ";
+    append_dec(trace, result);
+    trace.text += " (";
+    trace.text += identifier;
+    append_hex(trace, value);
+    trace.text += " = ";
+    append_hex(trace, result);
+    trace.text += ")\n";
+}
+
+static void trace_operator(output_buffer & trace, operator_t op, encoded_value left,
+                           encoded_value right, encoded_value result)
+{
+    /* left op right = result (left op right = result), in decimal then hex */
+    const char * identifier = operator_table[op].identifier;
+    append_dec(trace, left);
+    trace.text += ' ';
+    trace.text += identifier;
+    trace.text += ' ';
+    append_dec(trace, right);
+    trace.text += " = ";
+    append_dec(trace, result);
+    trace.text += " (";
+    append_hex(trace, left);
+    trace.text += ' ';
+    trace.text += identifier;
+    trace.text += ' ';
+    append_hex(trace, right);
+    trace.text += " = ";
+    append_hex(trace, result);
+    trace.text += ")\n";
+}
+
+void render_trace(output_buffer & out, const trace_step * steps, size_t count)
+/*! Format recorded steps the way they were always printed, one per line */
+{
+    for (size_t index = 0; index < count; index++)
+    {
+        const trace_step & step = steps[index];
+        operator_t op = (operator_t)step.op;
+        encoded_value left = {(encoding_t)step.encoding};
+        encoded_value right = left;
+        encoded_value result = left;
+        left.u128 = step.left;
+        right.u128 = step.right;
+        result.u128 = step.result;
+        if (operator_table[op].arity == BINARY)
+        {
+            trace_operator(out, op, left, right, result);
+        }
+        else
+        {
+            trace_operator(out, op, left, result);
+        }
+    }
+}
+
+void tokenize(const char * input, const char * end, encoding_t mode, bool names,
+              arena_vector<token> & tokens)
+/*! Split the whole line into tokens. Like the grammar, this alternates
+    between operand position, where literals, names and unary operators
+    are expected, and operator position. The stream ends with the
+    END_EXPRESSION operator, or with an error token that the parser
+    reports when it gets that far */
+{
+    tokens.clear();
+    const char * cursor = input;
+    bool operand = true;
+    while (true)
+    {
+        skip_whitespace(cursor, end);
+        token tok = {};
+        tok.position = cursor - input;
+        tok.kind = OPERATOR_TOKEN;
+        if (operand)
+        {
+            if (parse_value(cursor, end, mode, tok.value) != NO_ERROR)
+            {
+                tok.kind = RANGE_ERROR_TOKEN;
+                tokens.push_back(tok);
+                return;
+            }
+            if (tok.value.encoding != INVALID_ENCODING)
+            {
+                tok.kind = VALUE_TOKEN;
+                operand = false;
+            }
+            else if (names && cursor < end && (isalpha(*cursor) || *cursor == '_'))
+            {
+                /* Identifiers that parse_value didn't already take as a
+                   literal (e.g. hex "x1f", or "inf" in floating-point modes) */
+                while (cursor < end && (isalnum(*cursor) || *cursor == '_'))
+                {
+                    cursor++;
+                }
+                tok.kind = NAME_TOKEN;
+                operand = false;
+            }
+            else
+            {
+                tok.op = lex_operator(cursor, end, UNARY);
+            }
+        }
+        else
+        {
+            tok.op = lex_operator(cursor, end, BINARY);
+            operand = tok.op != INVALID_OP && operator_table[tok.op].arity == BINARY;
+        }
+        if (tok.kind == OPERATOR_TOKEN && tok.op == INVALID_OP)
+        {
+            tok.kind = PARSE_ERROR_TOKEN;
+            tokens.push_back(tok);
+            return;
+        }
+        tok.end = cursor - input;
+        tokens.push_back(tok);
+        if (tok.kind == OPERATOR_TOKEN && tok.op == END_EXPRESSION)
+        {
+            return;
+        }
+    }
+}
+
+static void emit(program & prog, opcode_t opcode, int operand, int position)
+{
+    instruction insn = {opcode, operand};
+    prog.code.push_back(insn);
+    prog.positions.push_back(position);
+    if (opcode == STORE)
+    {
+        /* Leaves the stack as it is */
+    }
+    else if (opcode != OPERATOR)
+    {
+        prog.depth++;
+    }
+    else if (operator_table[operand].arity == BINARY)
+    {
+        prog.depth--;
+    }
+    prog.max_depth = max(prog.max_depth, prog.depth);
+}
+
+bool is_supported(operator_t op, encoding_t mode)
+/*! Whether evaluate_operator can apply op in mode, asked of the
+    evaluators themselves with harmless operands */
+{
+    bool real = lane_encodings[mode] == F32 || lane_encodings[mode] == F64;
+    if (operator_table[op].arity == UNARY)
+    {
+        double real_result;
+        int64_t integer_result;
+        return real ? evaluate_operator_real<double>(op, 1.0, real_result) :
+                      evaluate_operator_integer<int64_t>(op, 1, integer_result);
+    }
+    double real_result;
+    int64_t integer_result;
+    return real ? evaluate_operator_real<double>(op, 1.0, 1.0, real_result) :
+                  evaluate_operator_integer<int64_t>(op, 1, 1, integer_result);
+}
+
+static bool emit_operator(program & prog, operator_t op, int position)
+/*! Operators the mode can't apply are rejected as soon as they are
+    complete, which is where evaluating while parsing used to fail */
+{
+    if (!is_supported(op, prog.mode))
+    {
+        return false;
+    }
+    emit(prog, OPERATOR, op, position);
+    return true;
+}
+
+static int bind_variable(const char * input, size_t next, program & prog)
+{
+    const token & tok = prog.tokens[next];
+    size_t size = tok.end - tok.position;
+    for (size_t index = 0; index < prog.variables.size(); index++)
+    {
+        const token & bound = prog.tokens[prog.variables[index]];
+        if (bound.end - bound.position == (int)size &&
+            memcmp(input + bound.position, input + tok.position, size) == 0)
+        {
+            return index;
+        }
+    }
+    prog.variables.push_back(next);
+    return prog.variables.size() - 1;
+}
+
+static operator_t expect_operator(program & prog, size_t & next, operator_t sentinel)
+/*! The next token must be a binary operator or the sentinel; otherwise
+    INVALID_OP, with next left at the token */
+{
+    const token & tok = prog.tokens[next];
+    if (tok.kind != OPERATOR_TOKEN ||
+        (operator_table[tok.op].arity != BINARY && tok.op != sentinel))
+    {
+        return INVALID_OP;
+    }
+    next++;
+    return tok.op;
+}
+
+static status_t compile_expression(const char * input, program & prog, size_t & next,
+                                   int & position)
+/*! Precedence climbing with an explicit operator stack rather than
+    recursion, so nesting is limited only by the length of the line.
+    Open parentheses and unary operators wait on the stack along with
+    binary operators. Each operator is emitted at the end of the token
+    that completes it, in the same order and with the same error
+    positions as recursive descent would give. On failure position is
+    the source offset of the error */
+{
+    arena_vector<operator_t> & pending = prog.pending;
+    pending.clear();
+    int open_parens = 0;
+    while (true)
+    {
+        /* Operand position: any unary operators and open parentheses, then a value */
+        const token * tok = &prog.tokens[next];
+        while (tok->kind == OPERATOR_TOKEN)
+        {
+            pending.push_back(tok->op);
+            if (tok->op == OPEN_PAREN)
+            {
+                open_parens++;
+            }
+            tok = &prog.tokens[++next];
+        }
+        switch (tok->kind)
+        {
+        case VALUE_TOKEN:
+            prog.immediates.push_back(tok->value);
+            emit(prog, IMMEDIATE, prog.immediates.size() - 1, tok->end);
+            break;
+        case NAME_TOKEN:
+            emit(prog, VARIABLE, bind_variable(input, next, prog), tok->end);
+            break;
+        case RANGE_ERROR_TOKEN:
+            position = tok->position;
+            return RANGE_ERROR;
+        default:
+            position = tok->position;
+            return PARSE_ERROR;
+        }
+        next++;
+
+        /* Operator position: close parentheses until a binary operator or the end */
+        while (true)
+        {
+            /* The value just completed is the operand of any unary operators before it */
+            position = prog.tokens[next - 1].end;
+            while (!pending.empty() && pending.back() != OPEN_PAREN &&
+                   operator_table[pending.back()].arity == UNARY)
+            {
+                if (!emit_operator(prog, pending.back(), position))
+                {
+                    return PARSE_ERROR;
+                }
+                pending.pop_back();
+            }
+
+            operator_t op = expect_operator(prog, next, open_parens ? CLOSE_PAREN : END_EXPRESSION);
+            if (op == INVALID_OP)
+            {
+                position = prog.tokens[next].position;
+                return PARSE_ERROR;
+            }
+            position = prog.tokens[next - 1].end;
+            int precedence = operator_table[op].precedence;
+            while (!pending.empty() && pending.back() != OPEN_PAREN &&
+                   operator_table[pending.back()].precedence >= precedence)
+            {
+                if (!emit_operator(prog, pending.back(), position))
+                {
+                    return PARSE_ERROR;
+                }
+                pending.pop_back();
+            }
+            if (op == END_EXPRESSION)
+            {
+                return NO_ERROR;
+            }
+            if (op != CLOSE_PAREN)
+            {
+                pending.push_back(op);
+                break;
+            }
+            pending.pop_back();
+            open_parens--;
+        }
+    }
+}
+
+status_t compile_tokens(const char *& cursor, const char * end, encoding_t mode,
+                        program & prog)
+/*! Compile prog.tokens, already tokenized from cursor to end; on
+    failure cursor points at the error */
+{
+    prog.mode = mode;
+    prog.code.clear();
+    prog.immediates.clear();
+    prog.variables.clear();
+    prog.positions.clear();
+    prog.depth = 0;
+    prog.max_depth = 0;
+    prog.temporaries = 0;
+    prog.source.assign(cursor, end - cursor);
+    /* Each token becomes at most one instruction or stacked operator */
+    prog.code.reserve(prog.tokens.size());
+    prog.positions.reserve(prog.tokens.size());
+    prog.pending.reserve(prog.tokens.size());
+    size_t next = 0;
+    int position = 0;
+    status_t status = compile_expression(cursor, prog, next, position);
+    if (status != NO_ERROR)
+    {
+        cursor += position;
+    }
+    return status;
+}
+
+status_t compile(const char *& cursor, const char * end, encoding_t mode, program & prog,
+             bool bind_variables)
+/*! Compile the expression from cursor to end; on failure cursor points
+    at the error. Unless bind_variables is set, identifiers are rejected */
+{
+    tokenize(cursor, end, mode, bind_variables, prog.tokens);
+    return compile_tokens(cursor, end, mode, prog);
+}
+
+template <typename type, bool real>
+static bool fold_as(operator_t op, const encoded_value * operands, encoded_value & result)
+{
+    type value = {};
+    bool success;
+    if (operator_table[op].arity == UNARY)
+    {
+        if constexpr (real)
+        {
+            success = evaluate_operator_real<type>(op, decode<type>(operands[0]), value);
+        }
+        else
+        {
+            success = evaluate_operator_integer<type>(op, decode<type>(operands[0]), value);
+        }
+    }
+    else
+    {
+        type left = decode<type>(operands[0]);
+        type right = decode<type>(operands[1]);
+        if constexpr (real)
+        {
+            success = evaluate_operator_real<type>(op, left, right, value);
+        }
+        else
+        {
+            /* Division that would trap is left for evaluation to report */
+            if ((op == DIVIDE || op == MODULUS) && may_trap(right))
+            {
+                return false;
+            }
+            success = evaluate_operator_integer<type>(op, left, right, value);
+        }
+    }
+    result = encode(operands[0].encoding, value);
+    return success;
+}
+
+static bool fold_operator(encoding_t mode, operator_t op, const encoded_value * operands,
+                          encoded_value & result)
+/*! Apply op to constant operands exactly as evaluation would */
+{
+    switch (mode)
+    {
+    case S8:
+        return fold_as<int8_t, false>(op, operands, result);
+    case S16:
+        return fold_as<int16_t, false>(op, operands, result);
+    case S32:
+        return fold_as<int32_t, false>(op, operands, result);
+    case S64:
+        return fold_as<int64_t, false>(op, operands, result);
+    case S128:
+        return fold_as<int128_t, false>(op, operands, result);
+    case U8:
+        return fold_as<uint8_t, false>(op, operands, result);
+    case U16:
+        return fold_as<uint16_t, false>(op, operands, result);
+    case U32:
+        return fold_as<uint32_t, false>(op, operands, result);
+    case U64:
+        return fold_as<uint64_t, false>(op, operands, result);
+    case U128:
+        return fold_as<uint128_t, false>(op, operands, result);
+    case F32:
+        return fold_as<float, true>(op, operands, result);
+    case F64:
+        return fold_as<double, true>(op, operands, result);
+    case S8X16:
+        return fold_as<packed<int8_t>, false>(op, operands, result);
+    case S16X8:
+        return fold_as<packed<int16_t>, false>(op, operands, result);
+    case S32X4:
+        return fold_as<packed<int32_t>, false>(op, operands, result);
+    case S64X2:
+        return fold_as<packed<int64_t>, false>(op, operands, result);
+    case U8X16:
+        return fold_as<packed<uint8_t>, false>(op, operands, result);
+    case U16X8:
+        return fold_as<packed<uint16_t>, false>(op, operands, result);
+    case U32X4:
+        return fold_as<packed<uint32_t>, false>(op, operands, result);
+    case U64X2:
+        return fold_as<packed<uint64_t>, false>(op, operands, result);
+    case F32X4:
+        return fold_as<packed<float>, true>(op, operands, result);
+    case F64X2:
+        return fold_as<packed<double>, true>(op, operands, result);
+    default:
+        return false;
+    }
+}
+
+struct expression_node
+/*! A distinct subexpression, found by value numbering the postfix code */
+{
+    opcode_t opcode; /* IMMEDIATE, VARIABLE or OPERATOR */
+    int operand;
+    int left;        /* Operand nodes, or -1 */
+    int right;
+    int uses;        /* Parent nodes referring to this one, plus one for the root */
+    int temporary;   /* Once stored, or -1 */
+};
+
+struct expression_graph
+{
+    const program * prog;
+    std::vector<expression_node> nodes;
+    std::map<std::array<uint64_t, 4>, int> lookup;
+    std::vector<encoded_value> immediates;
+};
+
+static int intern_node(expression_graph & graph, opcode_t opcode, int operand, int left, int right)
+{
+    std::array<uint64_t, 4> key = {(uint64_t)opcode, (uint64_t)operand, (uint64_t)left,
+                                   (uint64_t)right};
+    auto found = graph.lookup.find(key);
+    if (found != graph.lookup.end())
+    {
+        return found->second;
+    }
+    expression_node node = {opcode, operand, left, right, 0, -1};
+    graph.nodes.push_back(node);
+    int id = graph.nodes.size() - 1;
+    graph.lookup[key] = id;
+    if (left >= 0)
+    {
+        graph.nodes[left].uses++;
+    }
+    if (right >= 0)
+    {
+        graph.nodes[right].uses++;
+    }
+    return id;
+}
+
+static int intern_constant(expression_graph & graph, encoded_value value)
+{
+    /* Keyed on the value's bits, so equal constants share one immediate */
+    uint64_t bits[2] = {};
+    memcpy(bits, &value.u128, encoding_sizes[graph.prog->mode]);
+    std::array<uint64_t, 4> key = {(uint64_t)IMMEDIATE, bits[0], bits[1], 0};
+    auto found = graph.lookup.find(key);
+    if (found != graph.lookup.end())
+    {
+        return found->second;
+    }
+    graph.immediates.push_back(value);
+    expression_node node = {IMMEDIATE, (int)graph.immediates.size() - 1, -1, -1, 0, -1};
+    graph.nodes.push_back(node);
+    int id = graph.nodes.size() - 1;
+    graph.lookup[key] = id;
+    return id;
+}
+
+static int power_of_two(const expression_graph & graph, int id)
+/*! log2 of an unsigned constant node, or -1 */
+{
+    const expression_node & node = graph.nodes[id];
+    encoding_t mode = graph.prog->mode;
+    if (node.opcode != IMMEDIATE || mode < U8 || mode > U128)
+    {
+        return -1;
+    }
+    uint128_t bits = 0;
+    memcpy(&bits, &graph.immediates[node.operand].u128, encoding_sizes[mode]);
+    if (bits == 0 || (bits & (bits - 1)) != 0)
+    {
+        return -1;
+    }
+    uint64_t low = bits;
+    return low ? __builtin_ctzll(low) : 64 + __builtin_ctzll(bits >> 64);
+}
+
+static int build_operator_node(expression_graph & graph, operator_t op, int left, int right)
+/*! Fold constant operands, and turn unsigned multiplication, division
+    and modulus by a power of two into shifts and masks */
+{
+    const expression_node & left_node = graph.nodes[left];
+    encoding_t mode = graph.prog->mode;
+    if (left_node.opcode == IMMEDIATE && (right < 0 || graph.nodes[right].opcode == IMMEDIATE))
+    {
+        encoded_value operands[2] = {graph.immediates[left_node.operand]};
+        if (right >= 0)
+        {
+            operands[1] = graph.immediates[graph.nodes[right].operand];
+        }
+        encoded_value result;
+        if (fold_operator(mode, op, operands, result))
+        {
+            return intern_constant(graph, result);
+        }
+    }
+
+    int shift = right >= 0 ? power_of_two(graph, right) : -1;
+    if (shift >= 0 && (op == MULTIPLY || op == DIVIDE || op == MODULUS))
+    {
+        encoded_value operand = {};
+        operand.encoding = mode;
+        operand.u128 = op == MODULUS ? ((uint128_t)1 << shift) - 1 : shift;
+        right = intern_constant(graph, operand);
+        op = op == MULTIPLY ? LEFT_SHIFT : op == DIVIDE ? RIGHT_SHIFT : AND;
+    }
+    return intern_node(graph, OPERATOR, op, left, right);
+}
+
+static bool is_worth_storing(const expression_graph & graph, const expression_node & node)
+/*! Storing and loading a temporary costs about as much as an operator
+    on its leaves, so only larger or slower subexpressions are shared */
+{
+    if (node.opcode != OPERATOR || node.uses < 2)
+    {
+        return false;
+    }
+    if (node.operand == DIVIDE || node.operand == MODULUS)
+    {
+        return true;
+    }
+    return graph.nodes[node.left].opcode == OPERATOR ||
+           (node.right >= 0 && graph.nodes[node.right].opcode == OPERATOR);
+}
+
+void optimize(program & prog)
+/*! Rewrite prog with constant subexpressions folded, repeated ones
+    computed once into a temporary, and strength reduction. The code is
+    re-emitted in its original order; wherever a subexpression's node
+    says it can be done more cheaply, the code emitted for it so far is
+    dropped and replaced. Evaluation steps change, so this isn't for
+    verbose mode */
+{
+    expression_graph graph;
+    graph.prog = &prog;
+    graph.immediates.assign(prog.immediates.begin(), prog.immediates.end());
+
+    /* Value number each instruction's result */
+    std::vector<int> node_of(prog.code.size());
+    std::vector<int> values;
+    for (size_t pc = 0; pc < prog.code.size(); pc++)
+    {
+        const instruction & insn = prog.code[pc];
+        int id;
+        if (insn.opcode == IMMEDIATE)
+        {
+            id = intern_constant(graph, prog.immediates[insn.operand]);
+        }
+        else if (insn.opcode == VARIABLE)
+        {
+            id = intern_node(graph, VARIABLE, insn.operand, -1, -1);
+        }
+        else if (operator_table[insn.operand].arity == BINARY)
+        {
+            int right = values.back();
+            values.pop_back();
+            id = build_operator_node(graph, (operator_t)insn.operand, values.back(), right);
+            values.pop_back();
+        }
+        else
+        {
+            id = build_operator_node(graph, (operator_t)insn.operand, values.back(), -1);
+            values.pop_back();
+        }
+        node_of[pc] = id;
+        values.push_back(id);
+    }
+    graph.nodes[values.back()].uses++;
+
+    /* Re-emit, tracking where each stack value's code starts */
+    std::vector<instruction> code;
+    std::vector<int> positions;
+    std::vector<size_t> starts;
+    int temporaries = 0;
+    for (size_t pc = 0; pc < prog.code.size(); pc++)
+    {
+        const instruction & insn = prog.code[pc];
+        expression_node & node = graph.nodes[node_of[pc]];
+        size_t start = code.size();
+        size_t right_start = start;
+        if (insn.opcode == OPERATOR)
+        {
+            if (operator_table[insn.operand].arity == BINARY)
+            {
+                right_start = starts.back();
+                starts.pop_back();
+            }
+            start = starts.back();
+            starts.pop_back();
+        }
+
+        instruction replacement = {node.opcode, node.operand};
+        if (node.opcode != OPERATOR)
+        {
+            /* A leaf, or a folded constant */
+            code.resize(start);
+            positions.resize(start);
+        }
+        else if (node.temporary >= 0)
+        {
+            code.resize(start);
+            positions.resize(start);
+            replacement.opcode = LOAD;
+            replacement.operand = node.temporary;
+        }
+        else if (node.operand != insn.operand)
+        {
+            /* Strength reduced, with a new constant right operand */
+            code.resize(right_start);
+            positions.resize(right_start);
+            const expression_node & right = graph.nodes[node.right];
+            instruction constant = {IMMEDIATE, right.operand};
+            code.push_back(constant);
+            positions.push_back(prog.positions[pc]);
+        }
+        code.push_back(replacement);
+        positions.push_back(prog.positions[pc]);
+        if (replacement.opcode == OPERATOR && is_worth_storing(graph, node))
+        {
+            node.temporary = temporaries++;
+            instruction store = {STORE, node.temporary};
+            code.push_back(store);
+            positions.push_back(prog.positions[pc]);
+        }
+        starts.push_back(start);
+    }
+
+    prog.code.clear();
+    prog.positions.clear();
+    prog.immediates.assign(graph.immediates.begin(), graph.immediates.end());
+    prog.depth = 0;
+    prog.max_depth = 0;
+    for (size_t pc = 0; pc < code.size(); pc++)
+    {
+        emit(prog, code[pc].opcode, code[pc].operand, positions[pc]);
+    }
+    prog.temporaries = temporaries;
+}
+
+template <typename type, bool real>
+static status_t evaluate_native(const program & prog, const encoded_value * variables,
+                                type * stack, type & output, size_t & pc, trace_buffer * trace)
+/*! The evaluator for one encoding, working on native values */
+{
+    int top = -1;
+    for (pc = 0; pc < prog.code.size(); pc++)
+    {
+        const instruction & insn = prog.code[pc];
+        operator_t op = (operator_t)insn.operand;
+        bool success;
+        type result;
+        if (insn.opcode == IMMEDIATE)
+        {
+            stack[++top] = decode<type>(prog.immediates[insn.operand]);
+            continue;
+        }
+        else if (insn.opcode == VARIABLE)
+        {
+            stack[++top] = decode<type>(variables[insn.operand]);
+            continue;
+        }
+        else if (insn.opcode == STORE)
+        {
+            stack[prog.max_depth + insn.operand] = stack[top];
+            continue;
+        }
+        else if (insn.opcode == LOAD)
+        {
+            stack[top + 1] = stack[prog.max_depth + insn.operand];
+            top++;
+            continue;
+        }
+        else if (operator_table[op].arity == BINARY)
+        {
+            type left = stack[top - 1];
+            type right = stack[top];
+            if constexpr (real)
+            {
+                success = evaluate_operator_real<type>(op, left, right, result);
+            }
+            else
+            {
+                success = evaluate_operator_integer<type>(op, left, right, result);
+                if (!success && (op == DIVIDE || op == MODULUS))
+                {
+                    return DIVISION_ERROR;
+                }
+            }
+            if (success && trace)
+            {
+                trace->steps.push_back({(uint8_t)op, (uint8_t)prog.mode,
+                                        encode(prog.mode, left).u128,
+                                        encode(prog.mode, right).u128,
+                                        encode(prog.mode, result).u128});
+            }
+            top--;
+        }
+        else
+        {
+            type value = stack[top];
+            if constexpr (real)
+            {
+                success = evaluate_operator_real<type>(op, value, result);
+            }
+            else
+            {
+                success = evaluate_operator_integer<type>(op, value, result);
+            }
+            if (success && trace)
+            {
+                trace->steps.push_back({(uint8_t)op, (uint8_t)prog.mode,
+                                        encode(prog.mode, value).u128, 0,
+                                        encode(prog.mode, result).u128});
+            }
+        }
+        if (!success)
+        {
+            return PARSE_ERROR;
+        }
+        stack[top] = result;
+    }
+    output = stack[0];
+    return NO_ERROR;
+}
+
+template <typename type, bool real>
+static status_t evaluate_as(const program & prog, const encoded_value * variables,
+                            stack_slot * stack, encoded_value & result, size_t & pc,
+                            trace_buffer * trace)
+{
+    type value;
+    status_t status = evaluate_native<type, real>(prog, variables, (type *)stack, value, pc,
+                                                  trace);
+    if (status != NO_ERROR)
+    {
+        return status;
+    }
+    result = encode(prog.mode, value);
+    return NO_ERROR;
+}
+
+status_t evaluate_program(const program & prog, const encoded_value * variables,
+                          stack_slot * stack, encoded_value & result, size_t & pc,
+                          trace_buffer * trace)
+/*! variables holds one value per prog.variables entry, stack has room
+    for stack_slots(prog) values, and steps are recorded in trace unless it
+    is NULL, to be rendered later if at all. The encoding is dispatched once
+    here rather than per operator.
+    On failure pc is left at the instruction that could not be evaluated */
+{
+    switch (prog.mode)
+    {
+    case S8:
+        return evaluate_as<int8_t, false>(prog, variables, stack, result, pc, trace);
+    case S16:
+        return evaluate_as<int16_t, false>(prog, variables, stack, result, pc, trace);
+    case S32:
+        return evaluate_as<int32_t, false>(prog, variables, stack, result, pc, trace);
+    case S64:
+        return evaluate_as<int64_t, false>(prog, variables, stack, result, pc, trace);
+    case S128:
+        return evaluate_as<int128_t, false>(prog, variables, stack, result, pc, trace);
+    case U8:
+        return evaluate_as<uint8_t, false>(prog, variables, stack, result, pc, trace);
+    case U16:
+        return evaluate_as<uint16_t, false>(prog, variables, stack, result, pc, trace);
+    case U32:
+        return evaluate_as<uint32_t, false>(prog, variables, stack, result, pc, trace);
+    case U64:
+        return evaluate_as<uint64_t, false>(prog, variables, stack, result, pc, trace);
+    case U128:
+        return evaluate_as<uint128_t, false>(prog, variables, stack, result, pc, trace);
+    case F32:
+        return evaluate_as<float, true>(prog, variables, stack, result, pc, trace);
+    case F64:
+        return evaluate_as<double, true>(prog, variables, stack, result, pc, trace);
+    case S8X16:
+        return evaluate_as<packed<int8_t>, false>(prog, variables, stack, result, pc, trace);
+    case S16X8:
+        return evaluate_as<packed<int16_t>, false>(prog, variables, stack, result, pc, trace);
+    case S32X4:
+        return evaluate_as<packed<int32_t>, false>(prog, variables, stack, result, pc, trace);
+    case S64X2:
+        return evaluate_as<packed<int64_t>, false>(prog, variables, stack, result, pc, trace);
+    case U8X16:
+        return evaluate_as<packed<uint8_t>, false>(prog, variables, stack, result, pc, trace);
+    case U16X8:
+        return evaluate_as<packed<uint16_t>, false>(prog, variables, stack, result, pc, trace);
+    case U32X4:
+        return evaluate_as<packed<uint32_t>, false>(prog, variables, stack, result, pc, trace);
+    case U64X2:
+        return evaluate_as<packed<uint64_t>, false>(prog, variables, stack, result, pc, trace);
+    case F32X4:
+        return evaluate_as<packed<float>, true>(prog, variables, stack, result, pc, trace);
+    case F64X2:
+        return evaluate_as<packed<double>, true>(prog, variables, stack, result, pc, trace);
+    default:
+        fprintf(stderr, "evaluate_program: invalid encoding: %d\n", (int)prog.mode);
+        result = INVALID_VALUE;
+        return PARSE_ERROR;
+    }
+}
+
+encoding_t parse_mode(const char * mode_name)
+{
+    for (int mode = 0; mode < NUM_ENCODINGS; mode++)
+    {
+        if (strcmp(mode_name, encoding_names[mode]) == 0)
+        {
+            return (encoding_t)mode;
+        }
+    }
+    return INVALID_ENCODING;
+}
+
+template <typename vector, typename type, typename function>
+static KERNEL void map_vectors(type * values, int count, function f)
+/*! Lanes past count up to the end of the block are computed too, and
+    their results are garbage */
+{
+    for (int index = 0; index < count; index += sizeof(vector) / sizeof(type))
+    {
+        vector value;
+        memcpy(&value, &values[index], sizeof value);
+        f(value);
+        memcpy(&values[index], &value, sizeof value);
+    }
+}
+
+template <typename vector, typename type, typename function>
+static KERNEL void map_vectors(type * left, const type * right, int count, function f)
+{
+    for (int index = 0; index < count; index += sizeof(vector) / sizeof(type))
+    {
+        vector left_value, right_value;
+        memcpy(&left_value, &left[index], sizeof left_value);
+        memcpy(&right_value, &right[index], sizeof right_value);
+        f(left_value, right_value);
+        memcpy(&left[index], &left_value, sizeof left_value);
+    }
+}
+
+template <typename type>
+static KERNEL bool evaluate_lanes_integer(operator_t op, type * values, int count)
+{
+    typedef type vector __attribute__((vector_size(VECTOR_BYTES)));
+    switch (op)
+    {
+    case NOT:
+        map_vectors<vector>(values, count, [](vector & value) { value = ~value; });
+        return true;
+    case NEGATE:
+        map_vectors<vector>(values, count, [](vector & value) { value = -value; });
+        return true;
+    default:
+        return false;
+    }
+}
+
+template <typename type>
+static KERNEL bool evaluate_lanes_real(operator_t op, type * values, int count)
+{
+    typedef type vector __attribute__((vector_size(VECTOR_BYTES)));
+    switch (op)
+    {
+    case NEGATE:
+        map_vectors<vector>(values, count, [](vector & value) { value = -value; });
+        return true;
+    default:
+        return false;
+    }
+}
+
+template <typename type>
+static KERNEL bool is_uniform_shift(const type * amounts, int count)
+{
+    if (amounts[0] < 0 || amounts[0] >= (type)(8 * sizeof(type)))
+    {
+        return false;
+    }
+    bool uniform = true;
+    for (int index = 1; index < count; index++)
+    {
+        uniform &= amounts[index] == amounts[0];
+    }
+    return uniform;
+}
+
+template <typename type>
+static KERNEL bool evaluate_lanes_integer(operator_t op, type * left, const type * right, int count,
+                                          bool * trapped)
+/*! Division can trap and narrow shifts by varying amounts rely on integer
+    promotion, so those stay lane-at-a-time and keep
+    evaluate_operator_integer's semantics. A lane whose division would
+    trap is flagged in trapped and left as it is */
+{
+    typedef type vector __attribute__((vector_size(VECTOR_BYTES)));
+    switch (op)
+    {
+    case ADD:
+        map_vectors<vector>(left, right, count, [](vector & a, const vector & b) { a += b; });
+        return true;
+    case SUBTRACT:
+        map_vectors<vector>(left, right, count, [](vector & a, const vector & b) { a -= b; });
+        return true;
+    case MULTIPLY:
+        map_vectors<vector>(left, right, count, [](vector & a, const vector & b) { a *= b; });
+        return true;
+    case AND:
+        map_vectors<vector>(left, right, count, [](vector & a, const vector & b) { a &= b; });
+        return true;
+    case OR:
+        map_vectors<vector>(left, right, count, [](vector & a, const vector & b) { a |= b; });
+        return true;
+    case XOR:
+        map_vectors<vector>(left, right, count, [](vector & a, const vector & b) { a ^= b; });
+        return true;
+    case LEFT_SHIFT:
+    case RIGHT_SHIFT:
+        if (is_uniform_shift(right, count))
+        {
+            /* By a constant, such as from strength reduction; in range, the
+               lanes' own width gives the same result as integer promotion */
+            int amount = right[0];
+            if (op == LEFT_SHIFT)
+            {
+                map_vectors<vector>(left, count, [amount](vector & a) { a <<= amount; });
+            }
+            else
+            {
+                map_vectors<vector>(left, count, [amount](vector & a) { a >>= amount; });
+            }
+            return true;
+        }
+        /* Fall through */
+    case DIVIDE:
+    case MODULUS:
+        for (int index = 0; index < count; index++)
+        {
+            if (!evaluate_operator_integer<type>(op, left[index], right[index], left[index]))
+            {
+                trapped[index] = true;
+            }
+        }
+        return true;
+    default:
+        return false;
+    }
+}
+
+template <typename type>
+static KERNEL bool evaluate_lanes_real(operator_t op, type * left, const type * right, int count)
+{
+    typedef type vector __attribute__((vector_size(VECTOR_BYTES)));
+    switch (op)
+    {
+    case ADD:
+        map_vectors<vector>(left, right, count, [](vector & a, const vector & b) { a += b; });
+        return true;
+    case SUBTRACT:
+        map_vectors<vector>(left, right, count, [](vector & a, const vector & b) { a -= b; });
+        return true;
+    case MULTIPLY:
+        map_vectors<vector>(left, right, count, [](vector & a, const vector & b) { a *= b; });
+        return true;
+    case DIVIDE:
+        map_vectors<vector>(left, right, count, [](vector & a, const vector & b) { a /= b; });
+        return true;
+    default:
+        return false;
+    }
+}
+
+template <typename type, bool real>
+static KERNEL bool evaluate_lanes_wide(operator_t op, type * values, int count)
+/*! There are no vectors of 128-bit integers or of packed registers, so
+    these go a lane at a time, which the compiler still unrolls and
+    partly vectorizes */
+{
+    for (int index = 0; index < count; index++)
+    {
+        bool success;
+        if constexpr (real)
+        {
+            success = evaluate_operator_real<type>(op, values[index], values[index]);
+        }
+        else
+        {
+            success = evaluate_operator_integer<type>(op, values[index], values[index]);
+        }
+        if (!success)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+template <typename type, bool real>
+static KERNEL bool evaluate_lanes_wide(operator_t op, type * left, const type * right, int count,
+                                       bool * trapped)
+{
+    for (int index = 0; index < count; index++)
+    {
+        bool success;
+        if constexpr (real)
+        {
+            success = evaluate_operator_real<type>(op, left[index], right[index], left[index]);
+        }
+        else
+        {
+            success = evaluate_operator_integer<type>(op, left[index], right[index], left[index]);
+            if (!success && (op == DIVIDE || op == MODULUS))
+            {
+                trapped[index] = true;
+                success = true;
+            }
+        }
+        if (!success)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+template <typename type, bool real>
+static KERNEL bool evaluate_block(const program & prog, const char * columns, char * stack,
+                                  int count, size_t & pc, bool * trapped)
+/*! Apply each instruction to all count lanes at once. columns and
+    stack hold BLOCK_SIZE lanes per variable and per stack slot, and the
+    result is left in the first stack slot */
+{
+    int top = -1;
+    for (pc = 0; pc < prog.code.size(); pc++)
+    {
+        const instruction & insn = prog.code[pc];
+        type * slot = (type *)(stack + (top + 1) * BLOCK_SIZE * LANE_BYTES);
+        if (insn.opcode == IMMEDIATE)
+        {
+            type value;
+            memcpy(&value, &prog.immediates[insn.operand].u128, sizeof value);
+            for (int index = 0; index < BLOCK_SIZE; index++)
+            {
+                slot[index] = value;
+            }
+            top++;
+        }
+        else if (insn.opcode == VARIABLE)
+        {
+            memcpy(slot, columns + insn.operand * BLOCK_SIZE * LANE_BYTES,
+                   BLOCK_SIZE * sizeof(type));
+            top++;
+        }
+        else if (insn.opcode == STORE)
+        {
+            memcpy(stack + (prog.max_depth + insn.operand) * BLOCK_SIZE * LANE_BYTES,
+                   stack + top * BLOCK_SIZE * LANE_BYTES, BLOCK_SIZE * sizeof(type));
+        }
+        else if (insn.opcode == LOAD)
+        {
+            memcpy(slot, stack + (prog.max_depth + insn.operand) * BLOCK_SIZE * LANE_BYTES,
+                   BLOCK_SIZE * sizeof(type));
+            top++;
+        }
+        else if (operator_table[insn.operand].arity == BINARY)
+        {
+            type * left = (type *)(stack + (top - 1) * BLOCK_SIZE * LANE_BYTES);
+            type * right = (type *)(stack + top * BLOCK_SIZE * LANE_BYTES);
+            operator_t op = (operator_t)insn.operand;
+            bool success;
+            if constexpr (sizeof(type) > sizeof(uint64_t))
+            {
+                success = evaluate_lanes_wide<type, real>(op, left, right, count, trapped);
+            }
+            else if constexpr (real)
+            {
+                success = evaluate_lanes_real<type>(op, left, right, count);
+            }
+            else
+            {
+                success = evaluate_lanes_integer<type>(op, left, right, count, trapped);
+            }
+            if (!success)
+            {
+                return false;
+            }
+            top--;
+        }
+        else
+        {
+            type * values = (type *)(stack + top * BLOCK_SIZE * LANE_BYTES);
+            operator_t op = (operator_t)insn.operand;
+            bool success;
+            if constexpr (sizeof(type) > sizeof(uint64_t))
+            {
+                success = evaluate_lanes_wide<type, real>(op, values, count);
+            }
+            else if constexpr (real)
+            {
+                success = evaluate_lanes_real<type>(op, values, count);
+            }
+            else
+            {
+                success = evaluate_lanes_integer<type>(op, values, count);
+            }
+            if (!success)
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+MULTIVERSION
+bool evaluate_rows(const program & prog, const char * columns, char * stack,
+                   int count, size_t & pc, bool * trapped)
+{
+    memset(trapped, 0, count * sizeof *trapped);
+    switch (prog.mode)
+    {
+    case S8:
+        return evaluate_block<int8_t, false>(prog, columns, stack, count, pc, trapped);
+    case S16:
+        return evaluate_block<int16_t, false>(prog, columns, stack, count, pc, trapped);
+    case S32:
+        return evaluate_block<int32_t, false>(prog, columns, stack, count, pc, trapped);
+    case S64:
+        return evaluate_block<int64_t, false>(prog, columns, stack, count, pc, trapped);
+    case S128:
+        return evaluate_block<int128_t, false>(prog, columns, stack, count, pc, trapped);
+    case U8:
+        return evaluate_block<uint8_t, false>(prog, columns, stack, count, pc, trapped);
+    case U16:
+        return evaluate_block<uint16_t, false>(prog, columns, stack, count, pc, trapped);
+    case U32:
+        return evaluate_block<uint32_t, false>(prog, columns, stack, count, pc, trapped);
+    case U64:
+        return evaluate_block<uint64_t, false>(prog, columns, stack, count, pc, trapped);
+    case U128:
+        return evaluate_block<uint128_t, false>(prog, columns, stack, count, pc, trapped);
+    case F32:
+        return evaluate_block<float, true>(prog, columns, stack, count, pc, trapped);
+    case F64:
+        return evaluate_block<double, true>(prog, columns, stack, count, pc, trapped);
+    case S8X16:
+        return evaluate_block<packed<int8_t>, false>(prog, columns, stack, count, pc, trapped);
+    case S16X8:
+        return evaluate_block<packed<int16_t>, false>(prog, columns, stack, count, pc, trapped);
+    case S32X4:
+        return evaluate_block<packed<int32_t>, false>(prog, columns, stack, count, pc, trapped);
+    case S64X2:
+        return evaluate_block<packed<int64_t>, false>(prog, columns, stack, count, pc, trapped);
+    case U8X16:
+        return evaluate_block<packed<uint8_t>, false>(prog, columns, stack, count, pc, trapped);
+    case U16X8:
+        return evaluate_block<packed<uint16_t>, false>(prog, columns, stack, count, pc, trapped);
+    case U32X4:
+        return evaluate_block<packed<uint32_t>, false>(prog, columns, stack, count, pc, trapped);
+    case U64X2:
+        return evaluate_block<packed<uint64_t>, false>(prog, columns, stack, count, pc, trapped);
+    case F32X4:
+        return evaluate_block<packed<float>, true>(prog, columns, stack, count, pc, trapped);
+    case F64X2:
+        return evaluate_block<packed<double>, true>(prog, columns, stack, count, pc, trapped);
+    default:
+        fprintf(stderr, "evaluate_rows: invalid encoding: %d\n", (int)prog.mode);
+        return false;
+    }
+}
+
+void init_row_block(row_block & rows, const program & prog)
+{
+    rows.prog = &prog;
+    rows.count = 0;
+    size_t lane_size = BLOCK_SIZE * LANE_BYTES;
+    rows.columns = (char *)aligned_alloc(VECTOR_BYTES, max(1, prog.variables.size()) * lane_size);
+    rows.stack = (char *)aligned_alloc(VECTOR_BYTES, max(1, stack_slots(prog)) * lane_size);
+    memset(rows.columns, 0, max(1, prog.variables.size()) * lane_size);
+    memset(rows.stack, 0, max(1, stack_slots(prog)) * lane_size);
+    rows.trapped = (bool *)calloc(BLOCK_SIZE, sizeof *rows.trapped);
+}
+
+void free_row_block(row_block & rows)
+{
+    free(rows.columns);
+    free(rows.stack);
+    free(rows.trapped);
+}
+
+encoded_value lane_value(const row_block & rows, const char * lanes, int row)
+{
+    encoded_value value = {};
+    value.encoding = rows.prog->mode;
+    int size = encoding_sizes[rows.prog->mode];
+    memcpy(&value.u128, lanes + row * size, size);
+    return value;
+}
+
+}
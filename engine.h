@@ -0,0 +1,319 @@
+/*! The expression engine shared by the bincalc command and libbincalc:
+    lexing, compiling to postfix programs, optimizing, and evaluating
+    them one expression or a block of rows at a time. Nothing here keeps
+    global state, so separate programs and arenas can be used from
+    separate threads.
+
+    Internal to the project; services use the C API in bincalc.h.
+*/
+
+#ifndef BINCALC_ENGINE_H
+#define BINCALC_ENGINE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <new>
+#include <string>
+#include <vector>
+
+#include "bincalc-eval.h"
+
+namespace bincalc::engine
+{
+
+typedef __int128 int128_t;
+typedef unsigned __int128 uint128_t;
+
+enum encoding_t
+{
+    S8, S16, S32, S64, S128,
+    U8, U16, U32, U64, U128,
+    F32, F64,
+    /* Packed into 128 bits, as in SSE and NEON registers */
+    S8X16, S16X8, S32X4, S64X2,
+    U8X16, U16X8, U32X4, U64X2,
+    F32X4, F64X2,
+    NUM_ENCODINGS,
+    INVALID_ENCODING = -1,
+};
+
+struct encoded_value
+{
+    encoding_t encoding;
+    union
+    {
+        int8_t s8;
+        int16_t s16;
+        int32_t s32;
+        int64_t s64;
+        int128_t s128;
+
+        uint8_t u8;
+        uint16_t u16;
+        uint32_t u32;
+        uint64_t u64;
+        uint128_t u128; /* Also the bits of the narrower members */
+
+        float f32;
+        double f64;
+    };
+};
+
+extern const char * const encoding_names[NUM_ENCODINGS];
+extern const int encoding_sizes[NUM_ENCODINGS];
+extern const int lane_counts[NUM_ENCODINGS];            /* 1 for scalars */
+extern const encoding_t lane_encodings[NUM_ENCODINGS];  /* Each lane's; the same for scalars */
+
+enum status_t
+/*! How parsing, compiling or evaluating failed. Bad input is common
+    enough that it is returned rather than thrown, so a bad line costs
+    about as much as a good one */
+{
+    NO_ERROR,
+    PARSE_ERROR, /* Bad syntax, or an operator the mode can't apply */
+    RANGE_ERROR, /* A literal that doesn't fit the encoding */
+    DIVISION_ERROR, /* An integer division by 0, or of the most negative value by -1 */
+};
+
+const char * status_message(status_t status);
+
+inline int max(int a, int b)
+{
+    return a > b ? a : b;
+}
+
+void append(std::string & out, const char * format, ...)
+    __attribute__((format(printf, 2, 3)));
+
+enum
+{
+    ARENA_BLOCK_SIZE = 64 << 10,
+};
+
+struct arena
+/*! Bump allocator for everything compiled from a line. Nothing is
+    freed piecemeal; reset_arena releases it all at once and keeps the
+    blocks for the next line */
+{
+    std::vector<char *> blocks;
+    std::vector<size_t> sizes;
+    size_t current;
+    size_t used;
+};
+
+void * arena_alloc(arena & pool, size_t size, size_t align);
+void reset_arena(arena & pool);
+void free_arena(arena & pool);
+
+template <typename type>
+struct arena_allocator
+/*! Lets standard containers take their storage from an arena */
+{
+    typedef type value_type;
+    arena * pool;
+
+    arena_allocator(arena * pool) : pool(pool) {}
+    template <typename other>
+    arena_allocator(const arena_allocator<other> & allocator) : pool(allocator.pool) {}
+
+    type * allocate(size_t count)
+    {
+        return (type *)arena_alloc(*pool, count * sizeof(type), alignof(type));
+    }
+    void deallocate(type *, size_t) {}
+
+    template <typename other>
+    bool operator==(const arena_allocator<other> & allocator) const
+    {
+        return pool == allocator.pool;
+    }
+    template <typename other>
+    bool operator!=(const arena_allocator<other> & allocator) const
+    {
+        return pool != allocator.pool;
+    }
+};
+
+template <typename type>
+using arena_vector = std::vector<type, arena_allocator<type>>;
+typedef std::basic_string<char, std::char_traits<char>, arena_allocator<char>> arena_string;
+
+void skip_whitespace(const char *& cursor, const char * end);
+status_t parse_value(const char *& cursor, const char * end, encoding_t mode,
+                     encoded_value & value);
+encoding_t parse_mode(const char * mode_name);
+
+enum
+{
+    FORMAT_SIZE = 656, /* Enough for any value, including two lanes of -DBL_MAX with %f */
+};
+
+enum float_format_t
+{
+    FIXED_FLOAT,    /* %f, six places after the point */
+    SHORTEST_FLOAT, /* Fewest digits that read back to the same bits */
+};
+
+struct output_buffer
+/*! Text waiting to be written, and how values are formatted into it */
+{
+    std::string text;
+    float_format_t float_format;
+};
+
+int format_hex(encoded_value value, char * string);
+int format_dec(encoded_value value, char * string, float_format_t float_format = FIXED_FLOAT);
+void append_dec(output_buffer & out, encoded_value value);
+void append_hex(output_buffer & out, encoded_value value);
+
+template <typename type>
+inline encoded_value encode(encoding_t encoding, type value)
+{
+    encoded_value result = {};
+    result.encoding = encoding;
+    memcpy(&result.u128, &value, sizeof value);
+    return result;
+}
+
+template <typename type>
+inline type decode(const encoded_value & value)
+{
+    type result;
+    memcpy(&result, &value.u128, sizeof result);
+    return result;
+}
+
+enum token_kind_t
+{
+    VALUE_TOKEN,
+    NAME_TOKEN,
+    OPERATOR_TOKEN,
+    PARSE_ERROR_TOKEN,
+    RANGE_ERROR_TOKEN,
+};
+
+struct token
+{
+    token_kind_t kind;
+    operator_t op;       /* For OPERATOR_TOKEN */
+    encoded_value value; /* For VALUE_TOKEN */
+    int position;        /* Source offset of the first character */
+    int end;             /* Source offset one past the last character */
+};
+
+void tokenize(const char * input, const char * end, encoding_t mode, bool names,
+              arena_vector<token> & tokens);
+
+enum opcode_t
+{
+    IMMEDIATE,
+    VARIABLE,
+    OPERATOR,
+    STORE, /* Copy the top of the stack to a temporary */
+    LOAD,  /* Push a temporary */
+};
+
+struct instruction
+{
+    opcode_t opcode;
+    int operand; /* Index into the immediate pool, variables or temporaries, or an operator_t */
+};
+
+struct program
+/*! An expression compiled to postfix form, so it can be evaluated
+    without going back to the source text. All of its storage comes
+    from one arena, laid out contiguously as it is compiled */
+{
+    program(arena & pool)
+        : code(&pool), immediates(&pool), variables(&pool), tokens(&pool), pending(&pool),
+          source(&pool), positions(&pool), depth(0), max_depth(0), temporaries(0) {}
+
+    encoding_t mode;
+    arena_vector<instruction> code;
+    arena_vector<encoded_value> immediates;
+    arena_vector<int> variables; /* Token of each one's first appearance */
+    arena_vector<token> tokens;
+    arena_vector<operator_t> pending; /* Operator stack while compiling */
+    arena_string source;
+    arena_vector<int> positions; /* Source offset of each instruction */
+    int depth;
+    int max_depth;
+    int temporaries; /* Kept in the stack slots after max_depth */
+};
+
+typedef uint128_t stack_slot; /* Holds a value of any encoding */
+
+inline int stack_slots(const program & prog)
+{
+    return prog.max_depth + prog.temporaries;
+}
+
+struct trace_step
+/*! One operator applied while tracing, with the bits of its operands
+    and result. right is 0 for unary operators */
+{
+    uint8_t op;
+    uint8_t encoding;
+    uint128_t left;
+    uint128_t right;
+    uint128_t result;
+};
+
+struct trace_buffer
+/*! Steps recorded by evaluate_program; clearing it keeps the storage */
+{
+    std::vector<trace_step> steps;
+};
+
+void render_trace(output_buffer & out, const trace_step * steps, size_t count);
+
+bool is_supported(operator_t op, encoding_t mode);
+status_t compile_tokens(const char *& cursor, const char * end, encoding_t mode,
+                        program & prog);
+status_t compile(const char *& cursor, const char * end, encoding_t mode, program & prog,
+                 bool bind_variables = false);
+void optimize(program & prog);
+status_t evaluate_program(const program & prog, const encoded_value * variables,
+                          stack_slot * stack, encoded_value & result, size_t & pc,
+                          trace_buffer * trace);
+
+enum
+{
+    BLOCK_SIZE = 256,   /* Rows evaluated together in row mode */
+    VECTOR_BYTES = 64,  /* Split by the compiler into whatever the target has */
+    LANE_BYTES = 16,    /* Widest encoding */
+};
+
+/* Kernels are forced inline into each multiversioned clone of evaluate_rows */
+#define KERNEL inline __attribute__((always_inline))
+#if defined(__x86_64__)
+#define MULTIVERSION __attribute__((target_clones("avx512f", "avx2", "default")))
+#else
+#define MULTIVERSION
+#endif
+
+bool evaluate_rows(const program & prog, const char * columns, char * stack,
+                   int count, size_t & pc, bool * trapped);
+/*! False if an operator can't be applied, with pc at it. A row whose
+    integer division would trap is flagged in trapped instead, and its
+    result is garbage */
+
+struct row_block
+/*! Rows waiting to be evaluated together, stored column-wise */
+{
+    const program * prog;
+    int count;
+    char * columns;
+    char * stack;
+    bool * trapped; /* BLOCK_SIZE flags, for evaluate_rows */
+};
+
+void init_row_block(row_block & rows, const program & prog);
+void free_row_block(row_block & rows);
+encoded_value lane_value(const row_block & rows, const char * lanes, int row);
+
+}
+
+#endif
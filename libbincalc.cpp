@@ -0,0 +1,298 @@
+/*! The C API in bincalc.h, on top of the engine. Engine statuses map
+    onto bincalc_status, and running out of memory, the one failure the
+    engine throws for, is caught here */
+
+#include <new>
+
+#include "bincalc.h"
+#include "engine.h"
+
+using namespace bincalc::engine;
+
+static_assert(sizeof(bincalc_value) == sizeof(encoded_value), "bincalc_value layout");
+static_assert((int)BINCALC_F64X2 == (int)F64X2 && (int)BINCALC_INVALID_ENCODING == INVALID_ENCODING,
+              "bincalc_encoding values");
+
+struct bincalc_context
+{
+    encoding_t mode;
+    bool verbose;
+    arena pool;              /* Scratch for bincalc_evaluate, reset on each call */
+    trace_buffer trace;      /* Steps of the last evaluation in verbose mode */
+    output_buffer text;      /* Formatting options, and the steps once rendered */
+    bool rendered;
+    std::vector<stack_slot> stack;
+    size_t error_offset;
+};
+
+struct bincalc_program
+/*! A program and the arena its storage comes from */
+{
+    bincalc_program() : prog(pool) {}
+    ~bincalc_program() { free_arena(pool); }
+
+    arena pool;
+    program prog;
+};
+
+static encoded_value to_encoded(bincalc_value value)
+{
+    encoded_value result;
+    memcpy(&result, &value, sizeof result);
+    return result;
+}
+
+static bincalc_value to_public(encoded_value value)
+{
+    bincalc_value result;
+    memcpy(&result, &value, sizeof result);
+    return result;
+}
+
+static bool is_valid(bincalc_encoding mode)
+{
+    return mode >= 0 && mode < (int)NUM_ENCODINGS;
+}
+
+static bincalc_status status_of(status_t status)
+{
+    switch (status)
+    {
+    case NO_ERROR:
+        return BINCALC_OK;
+    case RANGE_ERROR:
+        return BINCALC_RANGE_ERROR;
+    case DIVISION_ERROR:
+        return BINCALC_DIVISION_ERROR;
+    default:
+        return BINCALC_PARSE_ERROR;
+    }
+}
+
+static bincalc_status run_program(bincalc_context * ctx, const program & prog,
+                                  const encoded_value * variables, bincalc_value * result)
+/*! On failure the error offset is that of the instruction that failed */
+{
+    size_t pc = 0;
+    ctx->trace.steps.clear();
+    ctx->rendered = false;
+    try
+    {
+        ctx->stack.resize(max(1, stack_slots(prog)));
+        encoded_value value;
+        status_t status = evaluate_program(prog, variables, ctx->stack.data(), value, pc,
+                                           ctx->verbose ? &ctx->trace : NULL);
+        if (status != NO_ERROR)
+        {
+            ctx->error_offset = pc < prog.positions.size() ? prog.positions[pc] : 0;
+            return status_of(status);
+        }
+        *result = to_public(value);
+        return BINCALC_OK;
+    }
+    catch (std::bad_alloc &)
+    {
+        return BINCALC_NO_MEMORY;
+    }
+}
+
+bincalc_context * bincalc_create(bincalc_encoding mode)
+{
+    if (!is_valid(mode))
+    {
+        return NULL;
+    }
+    bincalc_context * ctx = new (std::nothrow) bincalc_context {(encoding_t)mode, false};
+    if (ctx)
+    {
+        ctx->text.float_format = FIXED_FLOAT;
+    }
+    return ctx;
+}
+
+void bincalc_destroy(bincalc_context * ctx)
+{
+    if (ctx)
+    {
+        free_arena(ctx->pool);
+        delete ctx;
+    }
+}
+
+void bincalc_set_mode(bincalc_context * ctx, bincalc_encoding mode)
+{
+    if (is_valid(mode))
+    {
+        ctx->mode = (encoding_t)mode;
+    }
+}
+
+void bincalc_set_verbose(bincalc_context * ctx, int verbose)
+{
+    ctx->verbose = verbose;
+}
+
+void bincalc_set_shortest_float(bincalc_context * ctx, int shortest)
+{
+    ctx->text.float_format = shortest ? SHORTEST_FLOAT : FIXED_FLOAT;
+    ctx->rendered = false;
+}
+
+bincalc_status bincalc_evaluate(bincalc_context * ctx, const char * expression, size_t size,
+                                bincalc_value * result)
+{
+    const char * cursor = expression;
+    ctx->error_offset = 0;
+    try
+    {
+        reset_arena(ctx->pool);
+        program prog(ctx->pool);
+        status_t status = compile(cursor, expression + size, ctx->mode, prog);
+        if (status != NO_ERROR)
+        {
+            ctx->error_offset = cursor - expression;
+            return status_of(status);
+        }
+        return run_program(ctx, prog, NULL, result);
+    }
+    catch (std::bad_alloc &)
+    {
+        return BINCALC_NO_MEMORY;
+    }
+}
+
+bincalc_program * bincalc_compile(bincalc_context * ctx, const char * expression, size_t size,
+                                  bincalc_status * status)
+{
+    const char * cursor = expression;
+    ctx->error_offset = 0;
+    bincalc_program * prog = new (std::nothrow) bincalc_program;
+    if (!prog)
+    {
+        *status = BINCALC_NO_MEMORY;
+        return NULL;
+    }
+    try
+    {
+        *status = status_of(compile(cursor, expression + size, ctx->mode, prog->prog, true));
+    }
+    catch (std::bad_alloc &)
+    {
+        *status = BINCALC_NO_MEMORY;
+    }
+    if (*status != BINCALC_OK)
+    {
+        ctx->error_offset = cursor - expression;
+        delete prog;
+        return NULL;
+    }
+    return prog;
+}
+
+size_t bincalc_variable_count(const bincalc_program * prog)
+{
+    return prog->prog.variables.size();
+}
+
+const char * bincalc_variable_name(const bincalc_program * prog, size_t index, size_t * size)
+{
+    const token & name = prog->prog.tokens[prog->prog.variables[index]];
+    *size = name.end - name.position;
+    return prog->prog.source.data() + name.position;
+}
+
+bincalc_encoding bincalc_program_mode(const bincalc_program * prog)
+{
+    return (bincalc_encoding)prog->prog.mode;
+}
+
+bincalc_status bincalc_run(bincalc_context * ctx, const bincalc_program * prog,
+                           const bincalc_value * variables, size_t count,
+                           bincalc_value * result)
+{
+    ctx->error_offset = 0;
+    if (count != prog->prog.variables.size())
+    {
+        return BINCALC_INVALID_ARGUMENT;
+    }
+    try
+    {
+        std::vector<encoded_value> values(count);
+        for (size_t index = 0; index < count; index++)
+        {
+            if (variables[index].encoding != (bincalc_encoding)prog->prog.mode)
+            {
+                return BINCALC_INVALID_ARGUMENT;
+            }
+            values[index] = to_encoded(variables[index]);
+        }
+        return run_program(ctx, prog->prog, values.data(), result);
+    }
+    catch (std::bad_alloc &)
+    {
+        return BINCALC_NO_MEMORY;
+    }
+}
+
+void bincalc_free_program(bincalc_program * prog)
+{
+    delete prog;
+}
+
+size_t bincalc_error_offset(const bincalc_context * ctx)
+{
+    return ctx->error_offset;
+}
+
+const char * bincalc_trace(bincalc_context * ctx, size_t * size)
+{
+    if (!ctx->rendered)
+    {
+        ctx->text.text.clear();
+        render_trace(ctx->text, ctx->trace.steps.data(), ctx->trace.steps.size());
+        ctx->rendered = true;
+    }
+    *size = ctx->text.text.size();
+    return ctx->text.text.data();
+}
+
+const char * bincalc_status_message(bincalc_status status)
+{
+    switch (status)
+    {
+    case BINCALC_OK:
+        return "OK";
+    case BINCALC_PARSE_ERROR:
+        return "Parse error";
+    case BINCALC_RANGE_ERROR:
+        return "Value out of range";
+    case BINCALC_INVALID_ARGUMENT:
+        return "Invalid argument";
+    case BINCALC_NO_MEMORY:
+        return "Out of memory";
+    case BINCALC_DIVISION_ERROR:
+        return "Division traps";
+    default:
+        return "Unknown status";
+    }
+}
+
+int bincalc_format_dec(const bincalc_context * ctx, bincalc_value value, char * string)
+{
+    return format_dec(to_encoded(value), string, ctx->text.float_format);
+}
+
+int bincalc_format_hex(bincalc_value value, char * string)
+{
+    return format_hex(to_encoded(value), string);
+}
+
+bincalc_encoding bincalc_parse_mode(const char * name)
+{
+    return (bincalc_encoding)parse_mode(name);
+}
+
+const char * bincalc_mode_name(bincalc_encoding mode)
+{
+    return is_valid(mode) ? encoding_names[mode] : NULL;
+}
@@ -0,0 +1,49 @@
+/*! Exercises bincalc-eval.h; the constants are checked where they are
+    compiled, and test-bincalc compares the output */
+
+#include <stdio.h>
+#include <inttypes.h>
+
+#include "bincalc-eval.h"
+
+static_assert(bincalc::eval<uint16_t>("x1234 & ~x5678 | ~x1234 & x5678") == 0x444c);
+static_assert(bincalc::eval<int8_t>("x7f + 1") == -128);
+static_assert(bincalc::eval<int8_t>("-128 / 3 - 2 * (1 + 2)") == -48);
+static_assert(bincalc::eval<uint8_t>("- 1 >> 4") == 0x0f);
+static_assert(bincalc::eval<uint16_t>("65535 * 65535") == 1);
+static_assert(bincalc::eval<int32_t>("x7fffffff + 1") == INT32_MIN);
+static_assert(bincalc::eval<int64_t>("1 << 63") == INT64_MIN);
+static_assert(bincalc::eval<uint64_t>("~0 % 10") == 5);
+static_assert(bincalc::eval<unsigned __int128>("x1 << 127 | 1") ==
+              ((unsigned __int128)1 << 127 | 1));
+static_assert(bincalc::eval<float>("0.1 + 0.2") == 0.1f + 0.2f);
+static_assert(bincalc::eval<double>("0.1 + 0.2") == 0.1 + 0.2);
+static_assert(bincalc::eval<double>("-1 / 0") == -__builtin_inf());
+static_assert(bincalc::eval<float>("x3f800000 * 2.5e1") == 25);
+
+template <typename type>
+static void evaluate(const char * expression)
+/*! At run time, to report the errors that would fail to compile */
+{
+    try
+    {
+        printf("%s: %" PRId64 "\n", expression, (int64_t)bincalc::eval<type>(expression));
+    }
+    catch (bincalc::eval_error & error)
+    {
+        printf("%s: %s at %zu\n", expression, error.what(), error.offset);
+    }
+}
+
+int main()
+{
+    constexpr uint16_t mask = bincalc::eval<uint16_t>("xff00 >> 4 & ~x00f0");
+    printf("xff00 >> 4 & ~x00f0: %u\n", mask);
+    evaluate<int8_t>("100 + 28");
+    evaluate<int8_t>("200");
+    evaluate<int8_t>("1 + (2 * )");
+    evaluate<uint8_t>("-1");
+    evaluate<int32_t>("1 / (2 - 2)");
+    evaluate<uint32_t>("1 << 32");
+    evaluate<double>("1 % 2");
+}
@@ -0,0 +1,67 @@
+/*! Exercises the C API in bincalc.h; test-bincalc compares the output */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "bincalc.h"
+
+static void evaluate(bincalc_context * ctx, const char * expression)
+{
+    bincalc_value result;
+    bincalc_status status = bincalc_evaluate(ctx, expression, strlen(expression), &result);
+    if (status != BINCALC_OK)
+    {
+        printf("%s: %s at %zu\n", expression, bincalc_status_message(status),
+               bincalc_error_offset(ctx));
+        return;
+    }
+    char dec[BINCALC_FORMAT_SIZE];
+    char hex[BINCALC_FORMAT_SIZE];
+    bincalc_format_dec(ctx, result, dec);
+    bincalc_format_hex(result, hex);
+    printf("%s: %s (%s)\n", expression, dec, hex);
+}
+
+int main(void)
+{
+    bincalc_context * ctx = bincalc_create(bincalc_parse_mode("s8"));
+    evaluate(ctx, "100 + 27");
+    evaluate(ctx, "100 + 28");
+    evaluate(ctx, "1 + (2 * )");
+    evaluate(ctx, "200");
+    evaluate(ctx, "1 + 1 / (2 - 2)");
+    evaluate(ctx, "x80 % -1");
+
+    bincalc_set_mode(ctx, BINCALC_U16);
+    bincalc_set_verbose(ctx, 1);
+    evaluate(ctx, "x10 << 4");
+    size_t size;
+    const char * trace = bincalc_trace(ctx, &size);
+    printf("%.*s", (int)size, trace);
+    bincalc_set_verbose(ctx, 0);
+
+    const char * expression = "a * 3 + b";
+    bincalc_status status;
+    bincalc_program * prog = bincalc_compile(ctx, expression, strlen(expression), &status);
+    const char * name = bincalc_variable_name(prog, 1, &size);
+    printf("%s: %zu variables, second %.*s\n", bincalc_mode_name(bincalc_program_mode(prog)),
+           bincalc_variable_count(prog), (int)size, name);
+    bincalc_value variables[2] = {{BINCALC_U16}, {BINCALC_U16}};
+    variables[0].u16 = 21000;
+    variables[1].u16 = 7;
+    bincalc_value result;
+    status = bincalc_run(ctx, prog, variables, 2, &result);
+    printf("run: %s %u\n", bincalc_status_message(status), result.u16);
+    status = bincalc_run(ctx, prog, variables, 1, &result);
+    printf("run: %s\n", bincalc_status_message(status));
+    bincalc_free_program(prog);
+
+    bincalc_set_mode(ctx, BINCALC_U128);
+    evaluate(ctx, "x1 << 127 | 12345678901234567890");
+    evaluate(ctx, "-(1 << 100)");
+    bincalc_set_mode(ctx, BINCALC_S128);
+    evaluate(ctx, "-(1 << 100)");
+
+    bincalc_destroy(ctx);
+    return 0;
+}